@@ -0,0 +1,101 @@
+// renders, clicks and patches every aerodrome of a compiled config offline,
+// then compares each stage with the baseline kept next to this file. the
+// renderer needs gdi, so this runs on windows:
+//
+//   cargo bench -p bars-client --features bench -- CONFIG [--save]
+//
+// --save records the results as the new baseline instead of comparing.
+
+use bars_client::bench::{self, CountingAllocator, Record};
+
+use std::collections::HashMap;
+use std::fs::File;
+use std::io::{BufReader, BufWriter};
+use std::path::PathBuf;
+use std::process::ExitCode;
+
+use anyhow::{bail, Result};
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+// how far a stage's p50 may rise over the baseline before it is a regression
+const THRESHOLD: f64 = 0.2;
+// timings below this are too noisy to compare
+const MIN_P50_US: u32 = 50;
+
+fn main() -> Result<ExitCode> {
+	// cargo passes --bench to targets without the test harness
+	let mut config = None;
+	let mut save = false;
+	for arg in std::env::args().skip(1) {
+		match arg.as_str() {
+			"--bench" => (),
+			"--save" => save = true,
+			_ if config.is_none() => config = Some(arg),
+			_ => bail!("unexpected argument {arg}"),
+		}
+	}
+
+	let Some(config) = config else {
+		bail!("usage: render CONFIG [--save]");
+	};
+
+	let records = bench::run(&config)?;
+	let path = PathBuf::from(env!("CARGO_MANIFEST_DIR"))
+		.join("benches")
+		.join("baseline.json");
+
+	if save {
+		serde_json::to_writer_pretty(
+			BufWriter::new(File::create(&path)?),
+			&records,
+		)?;
+		for record in &records {
+			println!("{record}");
+		}
+
+		println!("saved baseline to {}", path.display());
+		return Ok(ExitCode::SUCCESS)
+	}
+
+	let baseline: HashMap<String, Record> = match File::open(&path) {
+		Ok(file) => {
+			let records: Vec<Record> = serde_json::from_reader(BufReader::new(file))?;
+			records.into_iter().map(|r| (r.name.clone(), r)).collect()
+		},
+		Err(_) => {
+			println!("no baseline at {}, run with --save", path.display());
+			HashMap::new()
+		},
+	};
+
+	let mut regressions = 0;
+	for record in &records {
+		let Some(base) = baseline.get(&record.name) else {
+			println!("{record} (new)");
+			continue
+		};
+
+		let slower = record.p50.max(base.p50) >= MIN_P50_US
+			&& record.p50 as f64 > base.p50 as f64 * (1.0 + THRESHOLD);
+		let allocating = record.allocations > base.allocations;
+
+		if slower || allocating {
+			regressions += 1;
+			println!(
+				"{record} (REGRESSED from p50 {}us, {} allocations)",
+				base.p50, base.allocations,
+			);
+		} else {
+			println!("{record} (baseline p50 {}us)", base.p50);
+		}
+	}
+
+	if regressions > 0 {
+		println!("{regressions} stages regressed");
+		Ok(ExitCode::FAILURE)
+	} else {
+		Ok(ExitCode::SUCCESS)
+	}
+}
@@ -2,11 +2,13 @@
 
 use crate::context::Context as ContextImpl;
 use crate::screen::Screen as ScreenImpl;
+use crate::stats::FrameStats;
 use crate::{
 	ActivityState, ClickType, ConnectionState, ViewportGeo, ViewportNonGeo,
 };
 
 use std::ffi::{c_char, CStr, CString};
+use std::time::Duration;
 
 use windows::Win32::Foundation::{POINT, RECT};
 use windows::Win32::Graphics::Gdi::HDC;
@@ -20,24 +22,68 @@ struct Screen {
 	screen: ScreenImpl<'static>,
 	geo: bool,
 	string: Option<CString>,
+	profiles: StringTable,
+	presets: StringTable,
+	views: StringTable,
+}
+
+// a null-terminated list of strings which is only rebuilt when its key
+// changes, so returned pointers stay valid until then
+#[derive(Default)]
+struct StringTable {
+	key: Option<(u64, usize)>,
 	strings: Vec<CString>,
-	string_ptrs: Vec<*const c_char>,
+	ptrs: Vec<*const c_char>,
+}
+
+impl StringTable {
+	fn load(
+		&mut self,
+		key: Option<(u64, usize)>,
+		strings: impl FnOnce() -> Vec<String>,
+	) -> &Self {
+		if self.ptrs.is_empty() || self.key != key {
+			self.strings.clear();
+			self.ptrs.clear();
+
+			for string in strings() {
+				let string =
+					unsafe { CString::from_vec_unchecked(string.into_bytes()) };
+				self.ptrs.push(string.as_ptr());
+				self.strings.push(string);
+			}
+
+			self.ptrs.push(std::ptr::null());
+			self.key = key;
+		}
+
+		self
+	}
+
+	fn as_ptr(&self) -> *const *const c_char {
+		self.ptrs.as_ptr()
+	}
+
+	fn len(&self) -> usize {
+		self.strings.len()
+	}
 }
 
 impl Screen {
-	fn load_strings(&mut self, strings: Vec<String>) -> *const *const c_char {
-		self.strings.clear();
-		self.string_ptrs.clear();
-
-		for string in strings {
-			let string = unsafe { CString::from_vec_unchecked(string.into_bytes()) };
-			self.string_ptrs.push(string.as_ptr());
-			self.strings.push(string);
-		}
+	fn profiles(&mut self) -> &StringTable {
+		let key = self.screen.instance().map(|instance| (instance, 0));
+		self.profiles.load(key, || self.screen.profiles())
+	}
 
-		self.string_ptrs.push(std::ptr::null());
+	fn presets(&mut self) -> &StringTable {
+		let profile = self.screen.profile();
+		let key = self.screen.instance().map(|instance| (instance, profile));
+		self.presets.load(key, || self.screen.presets())
+	}
 
-		self.string_ptrs.as_ptr()
+	fn views(&mut self) -> &StringTable {
+		let key = self.screen.instance().map(|instance| (instance, 0));
+		self.views.load(key, || self.screen.views())
 	}
 }
 
@@ -60,8 +106,8 @@ pub unsafe extern "C" fn client_exit(ctx: *mut Context) {
 }
 
 #[no_mangle]
-pub extern "C" fn client_tick(ctx: &mut Context) {
-	ctx.ctx.tick();
+pub extern "C" fn client_tick(ctx: &mut Context, budget_ms: u32) -> bool {
+	ctx.ctx.tick(Duration::from_millis(budget_ms as u64))
 }
 
 #[no_mangle]
@@ -119,8 +165,9 @@ pub extern "C" fn client_create_screen(
 		screen: ctx.ctx.create_screen(geo),
 		geo,
 		string: None,
-		strings: Vec::new(),
-		string_ptrs: Vec::new(),
+		profiles: StringTable::default(),
+		presets: StringTable::default(),
+		views: StringTable::default(),
 	}))
 }
 
@@ -175,7 +222,12 @@ pub extern "C" fn client_set_activity(
 pub extern "C" fn client_get_profiles(
 	screen: &mut Screen,
 ) -> *const *const c_char {
-	screen.load_strings(screen.screen.profiles())
+	screen.profiles().as_ptr()
+}
+
+#[no_mangle]
+pub extern "C" fn client_get_profile_count(screen: &mut Screen) -> usize {
+	screen.profiles().len()
 }
 
 #[no_mangle]
@@ -192,7 +244,12 @@ pub extern "C" fn client_set_profile(screen: &mut Screen, i: usize) {
 pub extern "C" fn client_get_presets(
 	screen: &mut Screen,
 ) -> *const *const c_char {
-	screen.load_strings(screen.screen.presets())
+	screen.presets().as_ptr()
+}
+
+#[no_mangle]
+pub extern "C" fn client_get_preset_count(screen: &mut Screen) -> usize {
+	screen.presets().len()
 }
 
 #[no_mangle]
@@ -204,7 +261,12 @@ pub extern "C" fn client_apply_preset(screen: &mut Screen, i: usize) {
 pub extern "C" fn client_get_views(
 	screen: &mut Screen,
 ) -> *const *const c_char {
-	screen.load_strings(screen.screen.views())
+	screen.views().as_ptr()
+}
+
+#[no_mangle]
+pub extern "C" fn client_get_view_count(screen: &mut Screen) -> usize {
+	screen.views().len()
 }
 
 #[no_mangle]
@@ -248,6 +310,11 @@ pub unsafe extern "C" fn client_draw_background(
 	}
 }
 
+#[no_mangle]
+pub extern "C" fn client_is_foreground_dirty(screen: &mut Screen) -> bool {
+	screen.screen.is_foreground_dirty()
+}
+
 #[no_mangle]
 pub extern "C" fn client_draw_foreground(screen: &mut Screen, hdc: HDC) {
 	screen.screen.draw_foreground(hdc);
@@ -292,6 +359,14 @@ pub extern "C" fn client_handle_click(
 	}
 }
 
+#[no_mangle]
+pub extern "C" fn client_get_frame_stats(
+	screen: &mut Screen,
+	stats: &mut FrameStats,
+) {
+	*stats = screen.screen.frame_stats();
+}
+
 #[no_mangle]
 pub extern "C" fn client_is_background_refresh_required(
 	screen: &mut Screen,
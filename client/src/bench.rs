@@ -0,0 +1,359 @@
+use crate::client::Client;
+use crate::context::Context;
+use crate::ipc::{self, Patch};
+use crate::screen::{Background, Screen};
+use crate::stats::{Histogram, Timing};
+use crate::{ClickType, ViewportGeo, ViewportNonGeo};
+
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::cell::Cell;
+use std::f64::consts::FRAC_PI_2;
+use std::fmt;
+use std::fs::File;
+use std::io::BufReader;
+use std::time::Instant;
+
+use anyhow::Result;
+
+use bars_config::{BlockState, Config, GeoPoint, Path};
+
+use serde::{Deserialize, Serialize};
+
+use windows::Win32::Foundation::POINT;
+
+const SIZES: &[(i32, i32)] = &[(1280, 720), (1920, 1080), (2560, 1440)];
+const ZOOMS: &[f64] = &[0.25, 1.0, 4.0];
+const ROUNDS: usize = 16;
+const CLICK_SPACING: i32 = 40;
+
+// the results of one stage for one aerodrome, in microseconds
+#[derive(Clone, Debug, Deserialize, Serialize)]
+pub struct Record {
+	pub name: String,
+	pub p50: u32,
+	pub p95: u32,
+	pub max: u32,
+	pub allocations: u64,
+}
+
+impl Record {
+	fn new(icao: &str, name: &str, timing: Timing, allocations: u64) -> Self {
+		Self {
+			name: format!("{icao} {name}"),
+			p50: timing.p50,
+			p95: timing.p95,
+			max: timing.max,
+			allocations,
+		}
+	}
+}
+
+impl fmt::Display for Record {
+	fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+		write!(
+			f,
+			"{}: p50 {}us, p95 {}us, max {}us, {} allocations per call",
+			self.name, self.p50, self.p95, self.max, self.allocations,
+		)
+	}
+}
+
+// times one stage of the benchmark, along with the allocations it makes
+#[derive(Default)]
+struct Stage {
+	time: Histogram,
+	calls: u64,
+	allocations: u64,
+}
+
+impl Stage {
+	fn run<T>(&mut self, f: impl FnOnce() -> T) -> T {
+		let allocations_start = allocations();
+		let instant_start = Instant::now();
+
+		let result = f();
+
+		self.time.record(instant_start.elapsed());
+		self.calls += 1;
+		self.allocations += allocations() - allocations_start;
+
+		result
+	}
+
+	fn report(&self, icao: &str, name: &str) -> Record {
+		let allocations = self.allocations / self.calls.max(1);
+		Record::new(icao, name, self.time.timing(), allocations)
+	}
+}
+
+#[derive(Default)]
+struct Stages {
+	background: Stage,
+	foreground: Stage,
+	click: Stage,
+	patch: Stage,
+	view_background_cold: Stage,
+	view_background: Stage,
+	view_foreground: Stage,
+}
+
+// renders every aerodrome of a compiled config into offscreen bitmaps at a
+// range of sizes and zooms, clicks across each frame and applies a sequence
+// of patches, all without a connection. returns one record per stage.
+pub fn run(path: &str) -> Result<Vec<Record>> {
+	let config = Config::load(BufReader::new(File::open(path)?))?;
+	let mut records = Vec::new();
+
+	for aerodrome in config.aerodromes {
+		let icao = aerodrome.icao.clone();
+
+		// keep the server end open so that sends from the client succeed
+		let (channel, _server) = ipc::mpsc_pair();
+		let client = Client::offline(channel, vec![aerodrome]);
+		let mut context = Context::offline(client);
+
+		let mut stages = Stages::default();
+		let targets = unsafe { run_geo(&mut context, &icao, &mut stages) };
+		unsafe { run_views(&mut context, &icao, &mut stages) };
+		run_patches(&mut context, &icao, &mut stages);
+
+		records.extend([
+			stages.background.report(&icao, "background"),
+			stages.foreground.report(&icao, "foreground"),
+			Record::new(&icao, "targets", targets, 0),
+			stages.click.report(&icao, "click"),
+			stages.patch.report(&icao, "patch"),
+			stages
+				.view_background_cold
+				.report(&icao, "view background (cold)"),
+			stages
+				.view_background
+				.report(&icao, "view background (cached)"),
+			stages.view_foreground.report(&icao, "view foreground"),
+		]);
+	}
+
+	Ok(records)
+}
+
+// returns the timing of target setup, which is recorded by the screen
+unsafe fn run_geo(
+	context: &mut Context,
+	icao: &str,
+	stages: &mut Stages,
+) -> Timing {
+	let Some(aerodrome) =
+		context.client().and_then(|c| c.aerodrome(&icao.into()))
+	else {
+		return Timing::default()
+	};
+	let Some((min, max)) = bounds(aerodrome.config()) else {
+		return Timing::default()
+	};
+
+	let mut screen = Screen::new(context, true);
+	screen.set_aerodrome(Some(icao));
+
+	let centre = ((min.0 + max.0) * 0.5, (min.1 + max.1) * 0.5);
+	let extent =
+		(max.0 - min.0).max((max.1 - min.1) * centre.0.to_radians().cos());
+
+	for &(width, height) in SIZES {
+		let Some(surface) = Background::new(None, (0, 0, width, height)) else {
+			continue
+		};
+
+		for &zoom in ZOOMS {
+			// pixels per degree of latitude with the aerodrome filling the
+			// height at a zoom of one, and square pixels at its latitude
+			let lat_scale = zoom * height as f64 / extent.max(1e-6);
+			let lon_scale = lat_scale * centre.0.to_radians().cos();
+
+			for round in 0..ROUNDS {
+				// pan by a pixel each round so that nothing is reused
+				let viewport = ViewportGeo {
+					origin: [
+						centre.0 + height as f64 * 0.5 / lat_scale,
+						centre.1 - (width as f64 * 0.5 + round as f64) / lon_scale,
+					],
+					scaling: [lat_scale, lon_scale],
+					rotation: FRAC_PI_2,
+					size: [width as f64, height as f64],
+				};
+
+				stages.background.run(|| {
+					screen.draw_background_geo(surface.dc, viewport);
+				});
+				stages.foreground.run(|| screen.draw_foreground(surface.dc));
+			}
+
+			for y in (0..height).step_by(CLICK_SPACING as usize) {
+				for x in (0..width).step_by(CLICK_SPACING as usize) {
+					let point = POINT { x, y };
+					stages.click.run(|| {
+						screen.handle_click(point, ClickType::Primary);
+					});
+				}
+			}
+		}
+	}
+
+	screen.frame_stats().targets
+}
+
+unsafe fn run_views(context: &mut Context, icao: &str, stages: &mut Stages) {
+	let views = (context.client())
+		.and_then(|c| c.aerodrome(&icao.into()))
+		.map_or(0, |aerodrome| aerodrome.config().views.len());
+
+	let mut screen = Screen::new(context, false);
+	screen.set_aerodrome(Some(icao));
+
+	for view in 0..views {
+		screen.set_view(view);
+
+		for &(width, height) in SIZES {
+			let Some(surface) = Background::new(None, (0, 0, width, height)) else {
+				continue
+			};
+
+			let viewport = ViewportNonGeo {
+				origin: [0.0; 2],
+				size: [width as f64, height as f64],
+			};
+
+			// the viewport stays put, so only the first draw at each size renders
+			// the view and the rest are answered from the background cache
+			for round in 0..ROUNDS {
+				let stage = if round == 0 {
+					&mut stages.view_background_cold
+				} else {
+					&mut stages.view_background
+				};
+				stage.run(|| screen.draw_background_non_geo(surface.dc, viewport));
+				stages
+					.view_foreground
+					.run(|| screen.draw_foreground(surface.dc));
+			}
+		}
+	}
+}
+
+// switches to each profile in turn, then sets every node and block through
+// patches as they would arrive from the server
+fn run_patches(context: &mut Context, icao: &str, stages: &mut Stages) {
+	let Some(aerodrome) = (context.client_mut())
+		.and_then(|client| client.aerodrome_mut(&icao.into()))
+	else {
+		return
+	};
+
+	let config = aerodrome.config();
+	let profiles = config.profiles.len() as u16;
+	let nodes = config.nodes.len() as u16;
+	let blocks = config.blocks.len() as u16;
+
+	for _ in 0..ROUNDS {
+		for profile in 0..profiles {
+			let patches = [
+				Patch {
+					profile: Some(profile),
+					..Default::default()
+				},
+				Patch {
+					nodes: (0..nodes).map(|i| (i, true)).collect(),
+					..Default::default()
+				},
+				Patch {
+					nodes: (0..nodes).map(|i| (i, false)).collect(),
+					..Default::default()
+				},
+				Patch {
+					blocks: (0..blocks).map(|i| (i, BlockState::Relax)).collect(),
+					..Default::default()
+				},
+				Patch {
+					blocks: (0..blocks).map(|i| (i, BlockState::Clear)).collect(),
+					..Default::default()
+				},
+			];
+
+			for patch in patches {
+				stages.patch.run(|| aerodrome.apply_patch(patch));
+			}
+		}
+	}
+}
+
+// the extent of everything drawn for the aerodrome, as (lat, lon)
+fn bounds(config: &bars_config::Aerodrome) -> Option<((f64, f64), (f64, f64))> {
+	let nodes = config.nodes.iter().flat_map(|node| {
+		let display = &node.display;
+		display
+			.off
+			.iter()
+			.chain(&display.on)
+			.chain(&display.selected)
+	});
+	let edges = (config.edges.iter())
+		.flat_map(|edge| edge.display.off.iter().chain(&edge.display.on));
+
+	nodes
+		.chain(edges)
+		.filter(|path: &&Path<GeoPoint>| !path.points.is_empty())
+		.map(|path| {
+			let (min, max) = path.bounds;
+			(
+				(min.geo.lat as f64, min.geo.lon as f64),
+				(max.geo.lat as f64, max.geo.lon as f64),
+			)
+		})
+		.reduce(|(amin, amax), (bmin, bmax)| {
+			(
+				(amin.0.min(bmin.0), amin.1.min(bmin.1)),
+				(amax.0.max(bmax.0), amax.1.max(bmax.1)),
+			)
+		})
+}
+
+thread_local! {
+	static ALLOCATIONS: Cell<u64> = const { Cell::new(0) };
+}
+
+// the system allocator, counting allocations made by each thread
+pub struct CountingAllocator;
+
+unsafe impl GlobalAlloc for CountingAllocator {
+	unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+		count();
+		System.alloc(layout)
+	}
+
+	unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+		count();
+		System.alloc_zeroed(layout)
+	}
+
+	unsafe fn realloc(
+		&self,
+		ptr: *mut u8,
+		layout: Layout,
+		new_size: usize,
+	) -> *mut u8 {
+		count();
+		System.realloc(ptr, layout, new_size)
+	}
+
+	unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+		System.dealloc(ptr, layout)
+	}
+}
+
+fn count() {
+	let _ = ALLOCATIONS.try_with(|n| n.set(n.get() + 1));
+}
+
+// allocations made so far by the calling thread
+fn allocations() -> u64 {
+	ALLOCATIONS.try_with(Cell::get).unwrap_or(0)
+}
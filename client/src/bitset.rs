@@ -0,0 +1,78 @@
+use serde::{Deserialize, Serialize};
+
+#[derive(Clone, Debug, Default, PartialEq, Eq, Deserialize, Serialize)]
+pub struct BitSet {
+	words: Vec<u64>,
+}
+
+impl BitSet {
+	pub fn new() -> Self {
+		Self::default()
+	}
+
+	pub fn get(&self, i: usize) -> bool {
+		self
+			.words
+			.get(i / 64)
+			.map(|word| word & (1 << (i % 64)) != 0)
+			.unwrap_or_default()
+	}
+
+	pub fn set(&mut self, i: usize, value: bool) {
+		if i / 64 >= self.words.len() {
+			if !value {
+				return
+			}
+
+			self.words.resize(i / 64 + 1, 0);
+		}
+
+		if value {
+			self.words[i / 64] |= 1 << (i % 64);
+		} else {
+			self.words[i / 64] &= !(1 << (i % 64));
+		}
+	}
+
+	pub fn is_empty(&self) -> bool {
+		self.words.iter().all(|word| *word == 0)
+	}
+
+	pub fn clear(&mut self) {
+		self.words.clear();
+	}
+
+	// whether every bit set here is also set in other
+	pub fn is_subset(&self, other: &BitSet) -> bool {
+		(self.words.iter().enumerate()).all(|(i, word)| {
+			word & !other.words.get(i).copied().unwrap_or_default() == 0
+		})
+	}
+
+	// indices of bits that differ from other, in ascending order
+	pub fn changes<'a>(
+		&'a self,
+		other: &'a BitSet,
+	) -> impl Iterator<Item = usize> + 'a {
+		let len = self.words.len().max(other.words.len());
+		(0..len).flat_map(move |i| {
+			let word = |set: &BitSet| set.words.get(i).copied().unwrap_or_default();
+			bits(i, word(self) ^ word(other))
+		})
+	}
+
+	// indices of set bits in ascending order
+	pub fn iter(&self) -> impl Iterator<Item = usize> + '_ {
+		(self.words.iter().enumerate()).flat_map(|(i, word)| bits(i, *word))
+	}
+}
+
+fn bits(i: usize, mut word: u64) -> impl Iterator<Item = usize> {
+	std::iter::from_fn(move || {
+		(word != 0).then(|| {
+			let bit = word.trailing_zeros() as usize;
+			word &= word - 1;
+			i * 64 + bit
+		})
+	})
+}
@@ -1,7 +1,12 @@
-use crate::ipc::{Channel, Downstream, Upstream};
+use crate::bitset::BitSet;
+use crate::ipc::{
+	Channel, Downstream, Patch, PendingPatch, Prepared, Scenery, Upstream,
+};
+use crate::timer::Timers;
 use crate::ActivityState;
 
 use std::collections::{HashMap, HashSet, VecDeque};
+use std::sync::atomic::{AtomicU64, Ordering};
 use std::time::{Duration, Instant};
 
 use bars_config::{
@@ -9,8 +14,6 @@ use bars_config::{
 	ResetCondition,
 };
 
-use bars_protocol::{BlockState as IpcBlockState, Patch};
-
 use anyhow::Result;
 
 use tracing::{debug, warn};
@@ -30,12 +33,36 @@ impl Client {
 		})
 	}
 
+	// a client holding the given aerodromes as if controlling them, for use
+	// without a server
+	#[cfg(feature = "bench")]
+	pub fn offline(
+		channel: Channel,
+		configs: Vec<bars_config::Aerodrome>,
+	) -> Self {
+		let aerodromes = (configs.into_iter())
+			.map(|config| {
+				let mut aerodrome = Aerodrome::new(config);
+				aerodrome.state = ActivityState::Controlling;
+				(aerodrome.config.icao.clone(), aerodrome)
+			})
+			.collect();
+
+		Self {
+			channel,
+			aerodromes,
+		}
+	}
+
 	pub fn disconnect(self) {}
 
-	pub fn tick(&mut self) -> Result<Vec<String>> {
+	// stops receiving once the deadline has passed, returning whether messages
+	// may be left over
+	pub fn tick(&mut self, deadline: Instant) -> Result<(Vec<String>, bool)> {
 		let mut user_messages = Vec::new();
+		let mut pending = false;
 
-		while let Some(message) = self.channel.recv()? {
+		while let Some(message) = self.channel.recv(deadline)? {
 			match message {
 				Downstream::Config { data } => {
 					self
@@ -43,6 +70,12 @@ impl Client {
 						.entry(data.icao.clone())
 						.or_insert_with(|| Aerodrome::new(data));
 				},
+				Downstream::Prepared(Prepared(aerodrome)) => {
+					self
+						.aerodromes
+						.entry(aerodrome.config().icao.clone())
+						.or_insert(*aerodrome);
+				},
 				Downstream::Control { icao, control } => {
 					if let Some(aerodrome) = self.aerodromes.get_mut(&icao) {
 						aerodrome.state = if control {
@@ -77,6 +110,11 @@ impl Client {
 					}
 				},
 			}
+
+			if Instant::now() >= deadline {
+				pending = self.channel.is_pending()?;
+				break
+			}
 		}
 
 		for (icao, aerodrome) in &mut self.aerodromes {
@@ -99,7 +137,7 @@ impl Client {
 			}
 		}
 
-		Ok(user_messages)
+		Ok((user_messages, pending))
 	}
 
 	pub fn set_tracking(&mut self, icao: String, track: bool) -> Result<()> {
@@ -128,6 +166,11 @@ impl Client {
 	}
 }
 
+fn next_revision() -> u64 {
+	static REVISION: AtomicU64 = AtomicU64::new(0);
+	REVISION.fetch_add(1, Ordering::Relaxed)
+}
+
 #[derive(Clone)]
 struct State<T> {
 	current: T,
@@ -140,17 +183,47 @@ impl<T> State<T> {
 	}
 }
 
+// node and edge states resolved against the current profile. nodes and
+// blocks are marked as they change and only the states depending on them are
+// re-evaluated by refresh_edges.
+#[derive(Clone, Default)]
+struct Resolved {
+	nodes: BitSet,
+	edges: BitSet,
+	dirty_nodes: BitSet,
+	dirty_blocks: BitSet,
+	all: bool,
+	scratch: RouteScratch,
+}
+
+// buffers reused by every routed edge evaluation, so that it does not
+// allocate once they have grown
+#[derive(Clone, Default)]
+struct RouteScratch {
+	cands: Vec<(usize, usize)>,
+	points: Vec<(usize, usize)>,
+	matches: (BitSet, BitSet),
+	ends: (BitSet, BitSet),
+}
+
+#[derive(Clone)]
 pub struct Aerodrome {
 	config: bars_config::Aerodrome,
 	state: ActivityState,
 
 	profile: usize,
-
-	node_ids: HashMap<String, usize>,
-	block_ids: HashMap<String, usize>,
-
-	node_conns: Vec<[Vec<(usize, bool)>; 2]>,
+	instance: u64,
+	revision: u64,
+
+	// connections leaving each node side, as a compressed adjacency list
+	// indexed by node * 2 + side
+	conn_offsets: Vec<usize>,
+	conns: Vec<(usize, bool)>,
+	non_routes: HashSet<(usize, usize, usize)>,
 	node_blocks: Vec<[usize; 2]>,
+	// blocks sharing a node with each block, as a route ends at nodes of its
+	// own block and its edges read the blocks on the far side of those
+	block_neighbours: Vec<Vec<usize>>,
 	children: HashMap<usize, Vec<usize>>,
 
 	nodes: Vec<State<bool>>,
@@ -158,56 +231,81 @@ pub struct Aerodrome {
 
 	aircraft: HashSet<String>,
 
-	pending_patch: Patch,
+	pending_patch: PendingPatch,
 	pending_nodes: Vec<usize>,
-	previous_edges: Vec<bool>,
+	previous_edges: BitSet,
 	node_dependencies: Vec<Vec<usize>>,
 	edge_dependencies: Vec<Vec<usize>>,
 
-	node_timers: Vec<(usize, Instant)>,
-	block_timers: Vec<(usize, Instant)>,
+	// per profile: router nodes and edges that read each node or block, and
+	// items hidden by a fixed off condition
+	node_edges: Vec<Vec<usize>>,
+	block_nodes: Vec<Vec<usize>>,
+	block_edges: Vec<Vec<usize>>,
+	hidden_nodes: BitSet,
+	hidden_edges: BitSet,
+	fixed_nodes: BitSet,
+	resolved: Resolved,
+	routes: HashMap<(usize, usize), Option<Vec<(usize, BlockState)>>>,
+
+	node_timers: Timers,
+	block_timers: Timers,
 }
 
 impl Aerodrome {
-	fn new(config: bars_config::Aerodrome) -> Self {
+	// the config has been through check_limits when loaded, so its profile,
+	// node and block indices fit the u16s used in patches
+	pub fn new(config: bars_config::Aerodrome) -> Self {
 		let mut this = Self {
 			config,
 			state: ActivityState::None,
 			profile: 0,
-			node_ids: HashMap::new(),
-			block_ids: HashMap::new(),
-			node_conns: Vec::new(),
+			instance: next_revision(),
+			revision: next_revision(),
+			conn_offsets: Vec::new(),
+			conns: Vec::new(),
+			non_routes: HashSet::new(),
 			node_blocks: Vec::new(),
+			block_neighbours: Vec::new(),
 			children: HashMap::new(),
 			nodes: Vec::new(),
 			blocks: Vec::new(),
 			aircraft: HashSet::new(),
 			pending_patch: Default::default(),
-			previous_edges: Vec::new(),
+			previous_edges: BitSet::new(),
 			pending_nodes: Vec::new(),
 			node_dependencies: Vec::new(),
 			edge_dependencies: Vec::new(),
-			node_timers: Vec::new(),
-			block_timers: Vec::new(),
+			node_edges: Vec::new(),
+			block_nodes: Vec::new(),
+			block_edges: Vec::new(),
+			hidden_nodes: BitSet::new(),
+			hidden_edges: BitSet::new(),
+			fixed_nodes: BitSet::new(),
+			resolved: Resolved::default(),
+			routes: HashMap::new(),
+			node_timers: Timers::new(),
+			block_timers: Timers::new(),
 		};
 
 		let mut borders = vec![0; this.config.nodes.len()];
-		this
-			.node_conns
-			.resize(this.config.nodes.len(), [Vec::new(), Vec::new()]);
+		let mut node_conns =
+			vec![[Vec::new(), Vec::new()]; this.config.nodes.len()];
 		this.node_blocks.resize(this.config.nodes.len(), [0; 2]);
 
 		for (i, node) in this.config.nodes.iter().enumerate() {
-			this.node_ids.insert(node.id.clone(), i);
-
 			if let Some(parent) = node.parent {
 				this.children.entry(parent).or_default().push(i);
 			}
 		}
 
 		for (i, block) in this.config.blocks.iter().enumerate() {
-			this.block_ids.insert(block.id.clone(), i);
+			for (a, b) in block.non_routes.iter().copied() {
+				this.non_routes.insert((i, a.min(b), a.max(b)));
+			}
+		}
 
+		for (i, block) in this.config.blocks.iter().enumerate() {
 			let conns = block
 				.nodes
 				.iter()
@@ -221,18 +319,32 @@ impl Aerodrome {
 				this.node_blocks[node][1] = i;
 				this.node_blocks[node][*node_borders] = i;
 
-				this.node_conns[node][*node_borders].extend(conns.iter().filter(
-					|(node_, _)| {
-						*node_ != node
-							&& !block.non_routes.contains(&(*node_, node))
-							&& !block.non_routes.contains(&(node, *node_))
-					},
+				node_conns[node][*node_borders].extend(conns.iter().filter(
+					|(node_, _)| *node_ != node && !this.is_non_route(i, *node_, node),
 				));
 
 				*node_borders += 1;
 			}
 		}
 
+		this.block_neighbours = vec![Vec::new(); this.config.blocks.len()];
+		for (i, block) in this.config.blocks.iter().enumerate() {
+			for node in block.nodes.iter().copied() {
+				for other in this.node_blocks[node] {
+					let neighbours = &mut this.block_neighbours[i];
+					if other != i && !neighbours.contains(&other) {
+						neighbours.push(other);
+					}
+				}
+			}
+		}
+
+		this.conn_offsets.push(0);
+		for conns in node_conns.iter().flatten() {
+			this.conns.extend_from_slice(conns);
+			this.conn_offsets.push(this.conns.len());
+		}
+
 		this
 			.node_dependencies
 			.resize(this.config.nodes.len(), Vec::new());
@@ -253,32 +365,15 @@ impl Aerodrome {
 		this
 	}
 
-	fn bs_ipc_to_conf(&self, state: IpcBlockState) -> Option<BlockState> {
-		Some(match state {
-			IpcBlockState::Clear => BlockState::Clear,
-			IpcBlockState::Relax => BlockState::Relax,
-			IpcBlockState::Route((a, b)) => {
-				BlockState::Route((*self.node_ids.get(&a)?, *self.node_ids.get(&b)?))
-			},
-		})
-	}
-
-	fn bs_conf_to_ipc(&self, state: &BlockState) -> IpcBlockState {
-		match state {
-			BlockState::Clear => IpcBlockState::Clear,
-			BlockState::Relax => IpcBlockState::Relax,
-			BlockState::Route((a, b)) => IpcBlockState::Route((
-				self.config.nodes[*a].id.clone(),
-				self.config.nodes[*b].id.clone(),
-			)),
+	pub fn apply_patch(&mut self, patch: Patch) {
+		if !patch.is_empty() {
+			self.revision = next_revision();
 		}
-	}
 
-	fn apply_patch(&mut self, patch: Patch) {
 		if let Some(profile) = patch.profile {
-			if let Some(i) = self.config.profiles.iter().position(|p| p.id == profile)
-			{
-				self.profile = i;
+			if (profile as usize) < self.config.profiles.len() {
+				self.profile = profile as usize;
+				self.load_profile();
 
 				self.node_timers.clear();
 				self.block_timers.clear();
@@ -287,61 +382,68 @@ impl Aerodrome {
 			}
 		}
 
-		for (id, state) in patch.nodes {
-			if let Some(i) = self.node_ids.get(&id).copied() {
+		for (i, state) in patch.nodes {
+			let i = i as usize;
+			if i < self.nodes.len() {
+				self.resolved.dirty_nodes.set(i, true);
 				self.nodes[i].current = state;
 				if self.nodes[i].pending == Some(state) {
 					self.nodes[i].pending = None;
 				} else {
-					self.node_timers.retain(|(node, _)| node != &i);
+					self.node_timers.cancel(i);
 				}
 			}
 		}
 
-		for (id, state) in patch.blocks {
-			if let Some(i) = self.block_ids.get(&id).copied() {
-				let Some(state) = self.bs_ipc_to_conf(state) else {
-					continue
-				};
+		for (i, state) in patch.blocks {
+			let i = i as usize;
+			if i < self.blocks.len() {
+				if let BlockState::Route((a, b)) = state {
+					if a >= self.nodes.len() || b >= self.nodes.len() {
+						continue
+					}
+				}
 
+				self.resolved.dirty_blocks.set(i, true);
 				self.blocks[i].current = state;
 				if self.blocks[i].pending == Some(state) {
 					self.blocks[i].pending = None;
 				} else {
-					self.block_timers.retain(|(block, _)| block != &i);
+					self.block_timers.cancel(i);
 				}
 			}
 		}
+
+		self.refresh_edges();
 	}
 
 	fn tick(&mut self) {
 		let now = Instant::now();
 
-		while self.node_timers.first().map(|(_, time)| time < &now) == Some(true) {
-			let (node, _) = self.node_timers.remove(0);
+		while let Some(node) = self.node_timers.pop_expired(now) {
 			self.set_node(node, true);
 		}
 
-		while self.block_timers.first().map(|(_, time)| time < &now) == Some(true) {
-			let (block, _) = self.block_timers.remove(0);
+		while let Some(block) = self.block_timers.pop_expired(now) {
 			self.set_block(block, BlockState::Clear);
 		}
 	}
 
-	fn take_pending(&mut self) -> (Patch, HashMap<String, bool>) {
-		let next_edges = self.calculate_edges();
+	fn take_pending(&mut self) -> (Patch, Scenery) {
+		self.refresh_edges();
+		let next_edges = &self.resolved.edges;
 
-		let patch = std::mem::take(&mut self.pending_patch);
+		let patch = self.pending_patch.take();
 		let nodes = std::mem::take(&mut self.pending_nodes);
-		let mut scenery = HashMap::new();
+		let mut scenery = Scenery::default();
 
 		if patch.profile.is_some() {
-			for element in &self.config.elements {
-				scenery.insert(
-					element.id.clone(),
+			for (i, element) in self.config.elements.iter().enumerate() {
+				scenery.set(
+					i,
 					match element.condition {
 						ElementCondition::Fixed(state) => state,
-						ElementCondition::Edge(edge) => next_edges[edge],
+						ElementCondition::Edge(edge) => next_edges.get(edge),
 						ElementCondition::Node(node) => *self.nodes[node].state(),
 					},
 				);
@@ -349,36 +451,139 @@ impl Aerodrome {
 		} else {
 			for i in nodes {
 				for element in &self.node_dependencies[i] {
-					scenery.insert(
-						self.config.elements[*element].id.clone(),
-						*self.nodes[i].state(),
-					);
+					scenery.set(*element, *self.nodes[i].state());
 				}
 			}
 
-			for (i, (prev, next)) in
-				next_edges.iter().zip(&self.previous_edges).enumerate()
-			{
-				if prev != next {
-					for element in &self.edge_dependencies[i] {
-						scenery.insert(self.config.elements[*element].id.clone(), *next);
-					}
+			for i in next_edges.changes(&self.previous_edges) {
+				for element in &self.edge_dependencies[i] {
+					scenery.set(*element, next_edges.get(i));
 				}
 			}
 		}
 
-		self.previous_edges = next_edges;
+		self.previous_edges = next_edges.clone();
 
 		(patch, scenery)
 	}
 
-	fn calculate_edges(&self) -> Vec<bool> {
-		(0..self.config.edges.len())
-			.map(|i| self.edge_state(i))
-			.collect()
+	fn load_profile(&mut self) {
+		let profile = &self.config.profiles[self.profile];
+
+		self.routes.clear();
+
+		self.node_edges = vec![Vec::new(); self.config.nodes.len()];
+		self.block_nodes = vec![Vec::new(); self.config.blocks.len()];
+		self.block_edges = vec![Vec::new(); self.config.blocks.len()];
+		self.hidden_nodes.clear();
+		self.hidden_edges.clear();
+		self.fixed_nodes.clear();
+
+		for (i, node) in profile.nodes.iter().enumerate() {
+			match *node {
+				NodeCondition::Fixed { state } => {
+					self.fixed_nodes.set(i, true);
+					self.hidden_nodes.set(i, !state);
+				},
+				NodeCondition::Direct { .. } => (),
+				NodeCondition::Router => {
+					// router nodes take their state from their blocks
+					let [b1, b2] = self.node_blocks[i];
+					self.block_nodes[b1].push(i);
+					if b2 != b1 {
+						self.block_nodes[b2].push(i);
+					}
+				},
+			}
+		}
+
+		for (i, edge) in profile.edges.iter().enumerate() {
+			match *edge {
+				EdgeCondition::Fixed { state } => self.hidden_edges.set(i, !state),
+				EdgeCondition::Direct { node } => self.node_edges[node].push(i),
+				EdgeCondition::Router { block, .. } => self.block_edges[block].push(i),
+			}
+		}
+
+		self.resolved.all = true;
+	}
+
+	fn refresh_edges(&mut self) {
+		let mut resolved = std::mem::take(&mut self.resolved);
+
+		if resolved.all {
+			for i in 0..self.config.nodes.len() {
+				resolved.nodes.set(i, self.evaluate_node(i));
+			}
+
+			for i in 0..self.config.edges.len() {
+				let state = self.evaluate_edge(&mut resolved, i);
+				resolved.edges.set(i, state);
+			}
+
+			resolved.all = false;
+		} else if !resolved.dirty_nodes.is_empty()
+			|| !resolved.dirty_blocks.is_empty()
+		{
+			self.update_edges(&mut resolved);
+		}
+
+		resolved.dirty_nodes.clear();
+		resolved.dirty_blocks.clear();
+
+		self.resolved = resolved;
+	}
+
+	fn update_edges(&self, resolved: &mut Resolved) {
+		let mut nodes = std::mem::take(&mut resolved.dirty_nodes);
+		let mut dirty = BitSet::new();
+
+		for block in resolved.dirty_blocks.iter() {
+			for node in &self.block_nodes[block] {
+				nodes.set(*node, true);
+			}
+		}
+
+		for node in nodes.iter() {
+			resolved.nodes.set(node, self.evaluate_node(node));
+
+			for edge in &self.node_edges[node] {
+				dirty.set(*edge, true);
+			}
+		}
+
+		for block in resolved.dirty_blocks.iter() {
+			for edge in &self.block_edges[block] {
+				dirty.set(*edge, true);
+			}
+
+			// routed edges also read the blocks adjacent to their endpoints
+			for other in self.block_neighbours[block].iter().copied() {
+				let BlockState::Route((a, b)) = *self.blocks[other].state() else {
+					continue
+				};
+
+				if self.node_blocks[a].contains(&block)
+					|| self.node_blocks[b].contains(&block)
+				{
+					for edge in &self.block_edges[other] {
+						dirty.set(*edge, true);
+					}
+				}
+			}
+		}
+
+		for edge in dirty.iter() {
+			let state = self.evaluate_edge(resolved, edge);
+			resolved.edges.set(edge, state);
+		}
 	}
 
 	fn set_default_state(&mut self, patch: bool) {
+		self.revision = next_revision();
+
+		self.load_profile();
+
 		self.nodes = Vec::with_capacity(self.config.nodes.len());
 		self.blocks = vec![
 			State {
@@ -399,22 +604,18 @@ impl Aerodrome {
 			});
 		}
 
+		self.refresh_edges();
+
 		if patch {
-			self.pending_patch.nodes =
-				HashMap::from_iter(self.nodes.iter().enumerate().map(
-					|(node, state)| (self.config.nodes[node].id.clone(), *state.state()),
-				));
+			for (node, state) in self.nodes.iter().enumerate() {
+				self.pending_patch.set_node(node as u16, *state.state());
+			}
 			self.pending_nodes = (0..self.nodes.len()).collect();
-			self.pending_patch.blocks = HashMap::from_iter(
-				self.blocks.iter().enumerate().map(|(block, state)| {
-					(
-						self.config.blocks[block].id.clone(),
-						self.bs_conf_to_ipc(state.state()),
-					)
-				}),
-			);
+			for (block, state) in self.blocks.iter().enumerate() {
+				self.pending_patch.set_block(block as u16, *state.state());
+			}
 		} else {
-			self.previous_edges = self.calculate_edges();
+			self.previous_edges = self.resolved.edges.clone();
 		}
 
 		self.node_timers.clear();
@@ -422,14 +623,14 @@ impl Aerodrome {
 	}
 
 	fn set_node_state(&mut self, node: usize, state: bool) {
+		self.revision = next_revision();
+
 		self.nodes[node].pending = Some(state);
-		self
-			.pending_patch
-			.nodes
-			.insert(self.config.nodes[node].id.clone(), state);
+		self.resolved.dirty_nodes.set(node, true);
+		self.pending_patch.set_node(node as u16, state);
 		self.pending_nodes.push(node);
 
-		self.node_timers.retain(|(node_, _)| node_ != &node);
+		self.node_timers.cancel(node);
 
 		if !state {
 			if let NodeCondition::Direct {
@@ -437,19 +638,19 @@ impl Aerodrome {
 			} = self.config.profiles[self.profile].nodes[node]
 			{
 				let deadline = Instant::now() + Duration::from_secs(secs as u64);
-				self.node_timers.push((node, deadline));
+				self.node_timers.set(node, deadline);
 			}
 		}
 	}
 
 	fn set_block_state(&mut self, block: usize, state: BlockState) {
+		self.revision = next_revision();
+
 		self.blocks[block].pending = Some(state);
-		self.pending_patch.blocks.insert(
-			self.config.blocks[block].id.clone(),
-			self.bs_conf_to_ipc(&state),
-		);
+		self.resolved.dirty_blocks.set(block, true);
+		self.pending_patch.set_block(block as u16, state);
 
-		self.block_timers.retain(|(block_, _)| block_ != &block);
+		self.block_timers.cancel(block);
 
 		if state != BlockState::Clear {
 			if let BlockCondition {
@@ -457,7 +658,7 @@ impl Aerodrome {
 			} = self.config.profiles[self.profile].blocks[block]
 			{
 				let deadline = Instant::now() + Duration::from_secs(secs as u64);
-				self.block_timers.push((block, deadline));
+				self.block_timers.set(block, deadline);
 			}
 		}
 	}
@@ -470,13 +671,24 @@ impl Aerodrome {
 		self.profile
 	}
 
+	// unique to this copy of the aerodrome, changes if it is re-downloaded
+	pub fn instance(&self) -> u64 {
+		self.instance
+	}
+
+	// changes whenever any displayed state changes, and is unique across
+	// aerodromes
+	pub fn revision(&self) -> u64 {
+		self.revision
+	}
+
 	pub fn set_profile(&mut self, i: usize) {
 		if i >= self.config.profiles.len() {
 			return
 		}
 
 		self.profile = i;
-		self.pending_patch.profile = Some(self.config.profiles[i].id.clone());
+		self.pending_patch.set_profile(i as u16);
 		self.set_default_state(true);
 	}
 
@@ -485,47 +697,48 @@ impl Aerodrome {
 			return
 		}
 
+		self.revision = next_revision();
+
 		let preset = &self.config.profiles[self.profile].presets[i];
-		let mut nodes = HashMap::new();
-		let mut blocks = HashMap::new();
+		let mut set = BitSet::new();
 
 		for (node, state) in &preset.nodes {
 			if (*node as u32) < u32::MAX {
 				self.nodes[*node].pending = Some(*state);
-				nodes.insert(self.config.nodes[*node].id.clone(), *state);
+				self.pending_patch.set_node(*node as u16, *state);
+				set.set(*node, true);
 			} else {
 				for node in 0..self.nodes.len() {
-					if !nodes.contains_key(&self.config.nodes[node].id) {
+					if !set.get(node) {
 						self.nodes[node].pending = Some(*state);
-						nodes.insert(self.config.nodes[node].id.clone(), *state);
+						self.pending_patch.set_node(node as u16, *state);
+						set.set(node, true);
 					}
 				}
 			}
 		}
 
+		set.clear();
+
 		for (block, state) in &preset.blocks {
 			if (*block as u32) < u32::MAX {
 				self.blocks[*block].pending = Some(*state);
-				blocks.insert(
-					self.config.blocks[*block].id.clone(),
-					self.bs_conf_to_ipc(state),
-				);
+				self.pending_patch.set_block(*block as u16, *state);
+				set.set(*block, true);
 			} else {
 				for block in 0..self.blocks.len() {
-					if !blocks.contains_key(&self.config.blocks[block].id) {
+					if !set.get(block) {
 						self.blocks[block].pending = Some(*state);
-						blocks.insert(
-							self.config.blocks[block].id.clone(),
-							self.bs_conf_to_ipc(state),
-						);
+						self.pending_patch.set_block(block as u16, *state);
+						set.set(block, true);
 					}
 				}
 			}
 		}
 
-		self.pending_patch.nodes = nodes;
 		self.pending_nodes = preset.nodes.iter().map(|(i, _)| *i).collect();
-		self.pending_patch.blocks = blocks;
+		self.resolved.all = true;
+		self.refresh_edges();
 
 		self.node_timers.clear();
 		self.block_timers.clear();
@@ -540,6 +753,23 @@ impl Aerodrome {
 	}
 
 	pub fn node_state(&self, node: usize) -> bool {
+		self.resolved.nodes.get(node)
+	}
+
+	// fixed nodes cannot be changed, and those fixed off are not drawn
+	pub fn is_node_fixed(&self, node: usize) -> bool {
+		self.fixed_nodes.get(node)
+	}
+
+	pub fn is_node_hidden(&self, node: usize) -> bool {
+		self.hidden_nodes.get(node)
+	}
+
+	pub fn is_edge_hidden(&self, edge: usize) -> bool {
+		self.hidden_edges.get(edge)
+	}
+
+	fn evaluate_node(&self, node: usize) -> bool {
 		match self.config.profiles[self.profile].nodes[node] {
 			NodeCondition::Fixed { state } => state,
 			NodeCondition::Direct { .. } => *self.nodes[node].state(),
@@ -556,41 +786,48 @@ impl Aerodrome {
 		}
 	}
 
-	fn route_candidates(&self, block: usize) -> Vec<(usize, usize)> {
+	// replaces routes with the candidate routes through the block
+	fn route_candidates(&self, block: usize, routes: &mut Vec<(usize, usize)>) {
+		routes.clear();
+
 		let BlockState::Route((ap, bp)) = *self.blocks[block].state() else {
-			return vec![]
+			return
 		};
 
-		let mut routes = Vec::new();
-
-		let ao = vec![ap];
-		let bo = vec![bp];
-		let ac = self.children.get(&ap).unwrap_or(&ao);
-		let bc = self.children.get(&bp).unwrap_or(&bo);
-
-		let non_routes = &self.config.blocks[block].non_routes;
+		let (ao, bo) = ([ap], [bp]);
+		let ac = self.children.get(&ap).map_or(&ao[..], Vec::as_slice);
+		let bc = self.children.get(&bp).map_or(&bo[..], Vec::as_slice);
 
 		for a in ac.iter().copied() {
 			for b in bc.iter().copied() {
-				if !non_routes.contains(&(a, b)) && !non_routes.contains(&(b, a)) {
+				if !self.is_non_route(block, a, b) {
 					routes.push((a, b));
 				}
 			}
 		}
-
-		routes
 	}
 
 	pub fn edge_state(&self, edge: usize) -> bool {
+		self.resolved.edges.get(edge)
+	}
+
+	fn evaluate_edge(&self, resolved: &mut Resolved, edge: usize) -> bool {
 		match self.config.profiles[self.profile].edges[edge] {
 			EdgeCondition::Fixed { state } => state,
-			EdgeCondition::Direct { node } => !self.node_state(node),
+			EdgeCondition::Direct { node } => !resolved.nodes.get(node),
 			EdgeCondition::Router { block, ref routes } => {
 				match *self.blocks[block].state() {
 					BlockState::Clear => false,
 					BlockState::Relax => true,
 					BlockState::Route((ap, bp)) => {
-						let cands = self.route_candidates(block);
+						let RouteScratch {
+							cands,
+							points,
+							matches,
+							ends,
+						} = &mut resolved.scratch;
+
+						self.route_candidates(block, cands);
 						match cands.len() {
 							0 => return false,
 							1 => {
@@ -603,42 +840,46 @@ impl Aerodrome {
 						// this implementation works for the most common cases only; it does
 						// not support the specification in full
 
-						let mut matches = (HashSet::new(), HashSet::new());
+						matches.0.clear();
+						matches.1.clear();
 
-						let ao = vec![ap];
-						let ac = self.children.get(&ap).unwrap_or(&ao);
+						let ao = [ap];
+						let ac = self.children.get(&ap).map_or(&ao[..], Vec::as_slice);
 						for (a, b) in routes.iter().copied() {
 							let (a, b) = if ac.contains(&a) { (a, b) } else { (b, a) };
 
-							matches.0.insert(a);
-							matches.1.insert(b);
+							matches.0.set(a, true);
+							matches.1.set(b, true);
 						}
 
-						let mut cands = (
-							HashSet::<usize>::from_iter(cands.iter().map(|r| r.0)),
-							HashSet::<usize>::from_iter(cands.iter().map(|r| r.1)),
-						);
+						ends.0.clear();
+						ends.1.clear();
+						for (a, b) in cands.iter().copied() {
+							ends.0.set(a, true);
+							ends.1.set(b, true);
+						}
 
-						for (parent, cands) in [(ap, &mut cands.0), (bp, &mut cands.1)] {
+						for (parent, ends) in [(ap, &mut ends.0), (bp, &mut ends.1)] {
 							let [b1, b2] = self.node_blocks[parent];
 							let adjacent = if b1 != block { b1 } else { b2 };
 
 							match *self.blocks[adjacent].state() {
 								BlockState::Clear => (),
-								BlockState::Relax => cands.clear(),
+								BlockState::Relax => ends.clear(),
 								BlockState::Route((a, b)) => {
-									let points = self.route_candidates(adjacent).into_iter();
+									if a == parent || b == parent {
+										self.route_candidates(adjacent, points);
 
-									if a == parent {
-										*cands = HashSet::from_iter(points.map(|r| r.0));
-									} else if b == parent {
-										*cands = HashSet::from_iter(points.map(|r| r.1));
+										ends.clear();
+										for (pa, pb) in points.iter().copied() {
+											ends.set(if a == parent { pa } else { pb }, true);
+										}
 									}
 								},
 							}
 						}
 
-						cands.0.is_subset(&matches.0) && cands.1.is_subset(&matches.1)
+						ends.0.is_subset(&matches.0) && ends.1.is_subset(&matches.1)
 					},
 				}
 			},
@@ -671,6 +912,17 @@ impl Aerodrome {
 					.flat_map(|node| self.node_blocks[*node]),
 			);
 		}
+
+		self.refresh_edges();
+	}
+
+	fn is_non_route(&self, block: usize, a: usize, b: usize) -> bool {
+		self.non_routes.contains(&(block, a.min(b), a.max(b)))
+	}
+
+	fn conns(&self, node: usize, side: bool) -> &[(usize, bool)] {
+		let i = node * 2 + side as usize;
+		&self.conns[self.conn_offsets[i]..self.conn_offsets[i + 1]]
 	}
 
 	pub fn set_route(&mut self, (orgn, dest): (usize, usize)) {
@@ -680,6 +932,29 @@ impl Aerodrome {
 			return
 		}
 
+		// routes only depend on the profile, so they are resolved once per pair
+		let route = match self.routes.get(&(orgn, dest)) {
+			Some(route) => route.clone(),
+			None => {
+				let route = self.find_route((orgn, dest));
+				self.routes.insert((orgn, dest), route.clone());
+				route
+			},
+		};
+
+		if let Some(route) = route {
+			for (block, state) in route {
+				self.set_block_state(block, state);
+			}
+
+			self.refresh_edges();
+		}
+	}
+
+	fn find_route(
+		&self,
+		(orgn, dest): (usize, usize),
+	) -> Option<Vec<(usize, BlockState)>> {
 		let mut nodes = VecDeque::from([(orgn, false, 0), (orgn, true, 0)]);
 		let mut visited = HashSet::from([(orgn, false), (orgn, true)]);
 		let mut chain = HashMap::new();
@@ -708,7 +983,7 @@ impl Aerodrome {
 
 						if i > 1000 {
 							warn!("overflow {chain:?} {visited:?} {nodes:?}");
-							return
+							return None
 						}
 					}
 
@@ -719,11 +994,11 @@ impl Aerodrome {
 					}
 				} else {
 					debug!("routing error");
-					return
+					return None
 				}
 			}
 
-			for (next_node, next_dir) in &self.node_conns[node][direction as usize] {
+			for (next_node, next_dir) in self.conns(node, direction) {
 				let next_key = (*next_node, !next_dir);
 				let next = (*next_node, !next_dir, distance + !transparent as usize);
 
@@ -740,24 +1015,28 @@ impl Aerodrome {
 			}
 		}
 
-		if let Some(list) = list {
-			if list[..list.len() - 1]
-				.iter()
-				.any(|key| revisited.contains(key))
-			{
-				debug!("routing error");
-				return
-			}
+		let list = list?;
+		if list[..list.len() - 1]
+			.iter()
+			.any(|key| revisited.contains(key))
+		{
+			debug!("routing error");
+			return None
+		}
 
-			for pair in list.windows(2) {
+		let route = list
+			.windows(2)
+			.map(|pair| {
 				let [(node2, _), (node1, direction1)] = pair else {
 					unreachable!()
 				};
 
 				let block = self.node_blocks[*node1][*direction1 as usize];
-				self.set_block_state(block, BlockState::Route((*node1, *node2)));
-			}
-		}
+				(block, BlockState::Route((*node1, *node2)))
+			})
+			.collect();
+
+		Some(route)
 	}
 
 	pub fn set_node(&mut self, node: usize, state: bool) {
@@ -769,6 +1048,7 @@ impl Aerodrome {
 			self.config.profiles[self.profile].nodes[node]
 		{
 			self.set_node_state(node, state);
+			self.refresh_edges();
 		}
 	}
 }
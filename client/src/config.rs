@@ -1,14 +1,22 @@
-use bars_config::{Aerodrome, Config};
+use bars_config::{Aerodrome, Config, Index};
 
+use std::fs::File;
+use std::io::BufReader;
 use std::path::{Path, PathBuf};
 
 use anyhow::Result;
 
+use reqwest::header::{ETAG, IF_NONE_MATCH};
+use reqwest::StatusCode;
+
 use serde::{Deserialize, Serialize};
 
+use tokio::task::spawn_blocking;
+
 use tracing::{debug, warn};
 
 const DEFAULT_PORT: u16 = 6866;
+const CACHE_DIR: &str = "cache";
 
 fn default_port() -> u16 {
 	DEFAULT_PORT
@@ -67,25 +75,37 @@ pub struct ConfigSource {
 	pub aerodromes: Vec<String>,
 }
 
+fn fnv1a(data: &[u8]) -> u64 {
+	data.iter().fold(0xcbf29ce484222325, |hash, byte| {
+		(hash ^ *byte as u64).wrapping_mul(0x100000001b3)
+	})
+}
+
+// compiled config sources are cached in an indexed form next to the plugin,
+// named by a hash of the source and validated once per session against the
+// source's ETag (or content hash for local files). decoding, encoding and
+// reading the cache run on the blocking pool, off the server's runtime.
 pub struct ConfigManager {
-	sources: Vec<(ConfigSource, Option<Config>)>,
+	sources: Vec<(ConfigSource, bool)>,
 	base: PathBuf,
+	http: reqwest::Client,
 }
 
 impl ConfigManager {
-	pub fn new(mapping: ConfigMapping) -> Self {
+	pub fn new(mapping: ConfigMapping, http: reqwest::Client) -> Self {
 		Self {
 			sources: mapping
 				.config
 				.into_iter()
-				.map(|source| (source, None))
+				.map(|source| (source, false))
 				.collect(),
 			base: mapping.base,
+			http,
 		}
 	}
 
 	pub async fn load(&mut self, icao: &String) -> Result<Option<Aerodrome>> {
-		let Some((source, config)) = self
+		let Some((source, validated)) = self
 			.sources
 			.iter_mut()
 			.find(|(source, _)| source.aerodromes.contains(icao))
@@ -94,32 +114,153 @@ impl ConfigManager {
 			return Ok(None)
 		};
 
-		if config.is_none() {
-			debug!("fetching uncached source {:?}", source.src);
+		let cache = self
+			.base
+			.join(CACHE_DIR)
+			.join(format!("{:016x}", fnv1a(source.src.as_bytes())));
+		let data_path = cache.with_extension("bars");
+		let tag_path = cache.with_extension("tag");
+
+		if !*validated {
+			match Self::fetch(&self.http, &self.base, source, &data_path, &tag_path)
+				.await
+			{
+				Ok(None) => {
+					debug!("cached source {:?} is current", source.src);
+					*validated = true;
+				},
+				Ok(Some((data, tag))) => {
+					debug!("fetched updated source {:?}", source.src);
+
+					let (config, indexed) = spawn_blocking(move || {
+						let config = Config::load(data.as_slice())?;
+						let mut indexed = Vec::new();
+						config.save_indexed(&mut indexed)?;
+						Ok::<_, anyhow::Error>((config, indexed))
+					})
+					.await??;
+
+					match Self::store(indexed, &tag, &data_path, &tag_path).await {
+						Ok(()) => *validated = true,
+						Err(err) => warn!("failed to cache {:?}: {err}", source.src),
+					}
+
+					let aerodrome = config
+						.aerodromes
+						.into_iter()
+						.find(|aerodrome| &aerodrome.icao == icao);
+					if aerodrome.is_none() {
+						warn!("loaded config source is missing advertised {icao}");
+					}
 
-			let data = if source.src.contains("://") {
-				reqwest::get(&source.src).await?.bytes().await?.to_vec()
-			} else {
-				let path = self.base.join(&source.src);
-				tokio::fs::read(path).await?
-			};
+					return Ok(aerodrome)
+				},
+				Err(err) => {
+					if !tokio::fs::try_exists(&data_path).await? {
+						return Err(err)
+					}
 
-			*config = Some(Config::load(data.as_slice())?);
+					warn!("failed to fetch {:?}, using cache: {err}", source.src);
+					*validated = true;
+				},
+			}
 		}
 
-		let config = config.as_mut().unwrap();
+		let aerodrome = {
+			let icao = icao.clone();
+			spawn_blocking(move || {
+				let mut reader = BufReader::new(File::open(&data_path)?);
+				let index = Index::load(&mut reader)?;
+				Ok::<_, anyhow::Error>(index.load_aerodrome(&mut reader, &icao)?)
+			})
+			.await??
+		};
 
-		let Some(i) = config
-			.aerodromes
-			.iter()
-			.position(|aerodrome| &aerodrome.icao == icao)
-		else {
+		let Some(aerodrome) = aerodrome else {
 			warn!("loaded config source is missing advertised {icao}");
 			return Ok(None)
 		};
 
 		debug!("loaded {icao} from {:?}", source.src);
 
-		Ok(Some(config.aerodromes.swap_remove(i)))
+		Ok(Some(aerodrome))
+	}
+
+	// returns the source's data and tag, or None if the cached copy is current
+	async fn fetch(
+		http: &reqwest::Client,
+		base: &Path,
+		source: &ConfigSource,
+		data_path: &Path,
+		tag_path: &Path,
+	) -> Result<Option<(Vec<u8>, String)>> {
+		// a cache written by an older version is refetched rather than trusted
+		let readable = {
+			let data_path = data_path.to_owned();
+			spawn_blocking(move || {
+				File::open(data_path)
+					.map(|file| Index::load(BufReader::new(file)).is_ok())
+					.unwrap_or_default()
+			})
+			.await?
+		};
+
+		let tag = if readable {
+			tokio::fs::read_to_string(tag_path).await.ok()
+		} else {
+			None
+		};
+
+		let (data, new_tag) = if source.src.contains("://") {
+			let mut request = http.get(&source.src);
+			if let Some(tag) = &tag {
+				request = request.header(IF_NONE_MATCH, tag.as_str());
+			}
+
+			let response = request.send().await?;
+			if response.status() == StatusCode::NOT_MODIFIED {
+				return Ok(None)
+			}
+
+			let response = response.error_for_status()?;
+			let etag = response
+				.headers()
+				.get(ETAG)
+				.and_then(|etag| etag.to_str().ok())
+				.map(|etag| etag.to_string());
+			let data = response.bytes().await?.to_vec();
+
+			let tag = etag.unwrap_or_else(|| format!("{:016x}", fnv1a(&data)));
+			(data, tag)
+		} else {
+			let data = tokio::fs::read(base.join(&source.src)).await?;
+			let tag = format!("{:016x}", fnv1a(&data));
+			(data, tag)
+		};
+
+		if tag.as_ref() == Some(&new_tag) {
+			Ok(None)
+		} else {
+			Ok(Some((data, new_tag)))
+		}
+	}
+
+	async fn store(
+		data: Vec<u8>,
+		tag: &str,
+		data_path: &Path,
+		tag_path: &Path,
+	) -> Result<()> {
+		if let Some(dir) = data_path.parent() {
+			tokio::fs::create_dir_all(dir).await?;
+		}
+
+		// replace the data atomically so an interrupted write is never trusted
+		let temp_path = data_path.with_extension("tmp");
+		tokio::fs::write(&temp_path, data).await?;
+		tokio::fs::rename(&temp_path, data_path).await?;
+		tokio::fs::write(tag_path, tag).await?;
+
+		Ok(())
 	}
 }
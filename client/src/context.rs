@@ -1,15 +1,17 @@
 use crate::client::Client;
 use crate::config::{ConfigMapping, LocalConfig};
 use crate::ipc::Channel;
-use crate::screen::Screen;
+use crate::screen::{SceneCache, SceneData, Screen};
 use crate::server::{ConnectOptions, Server};
+use crate::stats::Histogram;
 use crate::ConnectionState;
 
 use std::collections::VecDeque;
 use std::fs::File;
 use std::io::ErrorKind;
 use std::path::{Path, PathBuf};
-use std::time::Duration;
+use std::rc::Rc;
+use std::time::{Duration, Instant};
 
 use anyhow::Result;
 
@@ -28,6 +30,8 @@ pub struct Context {
 	dir: PathBuf,
 	state: ConnectionState,
 	tracked: Vec<String>,
+	tick_time: Histogram,
+	scenes: SceneCache,
 }
 
 impl Context {
@@ -117,11 +121,31 @@ impl Context {
 			dir: dir.into(),
 			state: ConnectionState::Disconnected,
 			tracked: Vec::new(),
+			tick_time: Histogram::default(),
+			scenes: SceneCache::default(),
 		})
 	}
 
+	// a context around an existing client, with no server or logging
+	#[cfg(feature = "bench")]
+	pub fn offline(client: Client) -> Self {
+		Self {
+			server: None,
+			client: Some(client),
+			messages: VecDeque::new(),
+			dir: PathBuf::new(),
+			state: ConnectionState::ConnectedLocal,
+			tracked: Vec::new(),
+			tick_time: Histogram::default(),
+			scenes: SceneCache::default(),
+		}
+	}
+
 	#[instrument(level = "trace", skip(self))]
-	pub fn tick(&mut self) {
+	pub fn tick(&mut self, budget: Duration) -> bool {
+		let instant_start = Instant::now();
+		let mut pending = false;
+
 		if let Some(server) = self.server.as_mut() {
 			if server.is_cancelled() {
 				debug!("disconnecting due to server cancellation");
@@ -132,11 +156,13 @@ impl Context {
 		}
 
 		if let Some(client) = self.client.as_mut() {
-			match client.tick() {
-				Ok(messages) => {
+			match client.tick(instant_start + budget) {
+				Ok((messages, more)) => {
 					for message in messages {
 						self.add_message(message);
 					}
+
+					pending = more;
 				},
 				Err(err) => {
 					warn!("{err}");
@@ -145,6 +171,14 @@ impl Context {
 				},
 			}
 		}
+
+		self.tick_time.record(instant_start.elapsed());
+
+		pending
+	}
+
+	pub fn tick_time(&self) -> &Histogram {
+		&self.tick_time
 	}
 
 	fn load_config(&mut self) -> Option<LocalConfig> {
@@ -320,6 +354,16 @@ impl Context {
 		self.client.as_mut()
 	}
 
+	// render data for an aerodrome, shared between screens
+	pub fn load_scene(
+		&mut self,
+		icao: &String,
+		view: Option<usize>,
+	) -> Option<Rc<SceneData>> {
+		let aerodrome = self.client.as_ref()?.aerodrome(icao)?;
+		Some(self.scenes.load(aerodrome, view))
+	}
+
 	pub fn track_aerodrome(&mut self, icao: String) {
 		if let Some(client) = self.client.as_mut() {
 			if !self.tracked.contains(&icao) {
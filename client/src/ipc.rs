@@ -1,12 +1,18 @@
-use std::collections::HashMap;
+use crate::bitset::BitSet;
+use crate::client::Aerodrome;
+use crate::ring::Ring;
+
 use std::fmt::{self, Debug, Formatter};
-use std::io::{ErrorKind, Write};
+use std::io::{ErrorKind, Read, Write};
 use std::net::{Ipv4Addr, TcpStream};
+use std::sync::{Arc, OnceLock};
+use std::time::Instant;
 
-use bars_protocol::Patch;
+use bars_config::BlockState;
 
 use anyhow::{bail, Result};
 
+use serde::de::DeserializeOwned;
 use serde::{Deserialize, Serialize};
 
 use tokio::io::{AsyncReadExt, AsyncWriteExt};
@@ -15,7 +21,7 @@ use tokio::net::TcpStream as AsyncTcpStream;
 use tokio::sync::mpsc::error::TryRecvError;
 use tokio::sync::mpsc::{self, UnboundedReceiver, UnboundedSender};
 
-use tracing::trace;
+use tracing::{trace, warn};
 
 #[derive(Clone, Debug, Deserialize, Serialize)]
 pub enum Upstream {
@@ -34,7 +40,12 @@ pub enum Upstream {
 	},
 	Scenery {
 		icao: String,
-		scenery: HashMap<String, bool>,
+		scenery: Scenery,
+	},
+	// names a ring for the server to write downstream messages to instead of
+	// the socket, see ring.rs
+	Ring {
+		name: String,
 	},
 }
 
@@ -50,11 +61,129 @@ impl Upstream {
 	}
 }
 
+// a state change keyed by config indices. ids are only used between the
+// server and the network, see server.rs.
+#[derive(Clone, Debug, Default, Deserialize, Serialize)]
+pub struct Patch {
+	pub profile: Option<u16>,
+	pub nodes: Vec<(u16, bool)>,
+	pub blocks: Vec<(u16, BlockState)>,
+}
+
+impl Patch {
+	pub fn is_empty(&self) -> bool {
+		self.profile.is_none() && self.nodes.is_empty() && self.blocks.is_empty()
+	}
+}
+
+// a patch being built up, where setting a node or block again replaces its
+// earlier value instead of adding another entry
+#[derive(Clone, Default)]
+pub struct PendingPatch {
+	patch: Patch,
+	// position of each index in the patch plus one, or zero if absent
+	nodes: Vec<u32>,
+	blocks: Vec<u32>,
+}
+
+impl PendingPatch {
+	pub fn set_profile(&mut self, profile: u16) {
+		self.patch.profile = Some(profile);
+	}
+
+	pub fn set_node(&mut self, i: u16, state: bool) {
+		set_slot(&mut self.patch.nodes, &mut self.nodes, i, state);
+	}
+
+	pub fn set_block(&mut self, i: u16, state: BlockState) {
+		set_slot(&mut self.patch.blocks, &mut self.blocks, i, state);
+	}
+
+	// folds a later patch into this one. applying the result has the same
+	// effect as applying both in turn unless the later one sets a profile,
+	// which is applied before any earlier entries that were merged.
+	pub fn merge(&mut self, patch: Patch) {
+		if let Some(profile) = patch.profile {
+			self.set_profile(profile);
+		}
+
+		for (i, state) in patch.nodes {
+			self.set_node(i, state);
+		}
+
+		for (i, state) in patch.blocks {
+			self.set_block(i, state);
+		}
+	}
+
+	pub fn is_empty(&self) -> bool {
+		self.patch.is_empty()
+	}
+
+	pub fn take(&mut self) -> Patch {
+		for (i, _) in &self.patch.nodes {
+			self.nodes[*i as usize] = 0;
+		}
+
+		for (i, _) in &self.patch.blocks {
+			self.blocks[*i as usize] = 0;
+		}
+
+		std::mem::take(&mut self.patch)
+	}
+}
+
+fn set_slot<T>(
+	entries: &mut Vec<(u16, T)>,
+	slots: &mut Vec<u32>,
+	i: u16,
+	value: T,
+) {
+	let slot = i as usize;
+	if slot >= slots.len() {
+		slots.resize(slot + 1, 0);
+	}
+
+	match slots[slot] {
+		0 => {
+			entries.push((i, value));
+			slots[slot] = entries.len() as u32;
+		},
+		n => entries[n as usize - 1].1 = value,
+	}
+}
+
+// element states, for the elements present in the mask
+#[derive(Clone, Debug, Default, Deserialize, Serialize)]
+pub struct Scenery {
+	pub mask: BitSet,
+	pub state: BitSet,
+}
+
+impl Scenery {
+	pub fn set(&mut self, element: usize, state: bool) {
+		self.mask.set(element, true);
+		self.state.set(element, state);
+	}
+
+	pub fn is_empty(&self) -> bool {
+		self.mask.is_empty()
+	}
+
+	pub fn iter(&self) -> impl Iterator<Item = (usize, bool)> + '_ {
+		self.mask.iter().map(|i| (i, self.state.get(i)))
+	}
+}
+
 #[derive(Clone, Debug, Deserialize, Serialize)]
 pub enum Downstream {
 	Config {
 		data: bars_config::Aerodrome,
 	},
+	// a config already built into an aerodrome on the server thread, only sent
+	// in-process
+	#[serde(skip)]
+	Prepared(Prepared),
 	Control {
 		icao: String,
 		control: bool,
@@ -78,6 +207,7 @@ impl Downstream {
 	pub fn icao(&self) -> &String {
 		match self {
 			Self::Config { data } => &data.icao,
+			Self::Prepared(prepared) => &prepared.0.config().icao,
 			Self::Control { icao, .. } => icao,
 			Self::Patch { icao, .. } => icao,
 			Self::Aircraft { icao, .. } => icao,
@@ -90,7 +220,7 @@ struct HideConfig<'a>(&'a Downstream);
 
 impl<'a> Debug for HideConfig<'a> {
 	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
-		if matches!(self.0, Downstream::Config { .. }) {
+		if matches!(self.0, Downstream::Config { .. } | Downstream::Prepared(_)) {
 			f.debug_struct("Config").finish_non_exhaustive()
 		} else {
 			write!(f, "{:?}", self.0)
@@ -98,19 +228,151 @@ impl<'a> Debug for HideConfig<'a> {
 	}
 }
 
+#[derive(Clone)]
+pub struct Prepared(pub Box<Aerodrome>);
+
+impl Debug for Prepared {
+	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+		f.debug_struct("Prepared").finish_non_exhaustive()
+	}
+}
+
+// upstream messages are small, so the server rejects anything larger as
+// malformed. downstream carries whole configs, which can pass 16 MiB for the
+// largest aerodromes, so clients allow more but still bound what they buffer.
+const MAX_FRAME: usize = 0x100_0000;
+const MAX_DOWNSTREAM_FRAME: usize = 0x1000_0000;
+const RING_WAIT_MS: u32 = 100;
+
+// messages over tcp are a u32 length followed by the bincode body. each is
+// serialised into one buffer so it goes out in a single write, rather than
+// one write per field.
+fn frame<T: Serialize>(message: &T) -> Result<Vec<u8>> {
+	let mut data = vec![0; 4];
+	bincode::serialize_into(&mut data, message)?;
+
+	let n = (data.len() - 4) as u32;
+	data[..4].copy_from_slice(&n.to_le_bytes());
+	Ok(data)
+}
+
+// a message sent to many subscribers. cloning shares it, and the tcp frame
+// is serialised by the first subscriber to need it and reused by the rest.
+#[derive(Clone)]
+pub struct Shared(Arc<SharedData>);
+
+struct SharedData {
+	message: Downstream,
+	frame: OnceLock<Option<Arc<[u8]>>>,
+}
+
+impl Shared {
+	pub fn new(message: Downstream) -> Self {
+		Self(Arc::new(SharedData {
+			message,
+			frame: OnceLock::new(),
+		}))
+	}
+
+	pub fn message(&self) -> &Downstream {
+		&self.0.message
+	}
+
+	fn frame(&self) -> Result<Arc<[u8]>> {
+		let data = &self.0;
+		let frame = data
+			.frame
+			.get_or_init(|| frame(&data.message).ok().map(Arc::from));
+		match frame {
+			Some(frame) => Ok(frame.clone()),
+			None => bail!("downstream serialisation failed"),
+		}
+	}
+}
+
+// bytes received but not yet decoded. decoding a frame only advances the
+// offset, and the consumed bytes are dropped once before more are appended.
+#[derive(Default)]
+pub struct FrameBuf {
+	data: Vec<u8>,
+	offset: usize,
+}
+
+impl FrameBuf {
+	fn extend(&mut self, bytes: &[u8]) {
+		if self.offset > 0 {
+			self.data.drain(..self.offset);
+			self.offset = 0;
+		}
+
+		self.data.extend_from_slice(bytes);
+	}
+
+	// decodes the first complete frame, if any
+	fn take<T: DeserializeOwned>(&mut self) -> Result<Option<T>> {
+		let buf = &self.data[self.offset..];
+		let Some(header) = buf.get(..4) else {
+			return Ok(None)
+		};
+
+		let n = u32::from_le_bytes(header.try_into().unwrap()) as usize;
+		if n > MAX_DOWNSTREAM_FRAME {
+			bail!("oversized packet");
+		} else if buf.len() < n + 4 {
+			return Ok(None)
+		}
+
+		let message = bincode::deserialize(&buf[4..n + 4])?;
+		self.offset += n + 4;
+		Ok(Some(message))
+	}
+
+	// whether part of a frame has been received
+	fn is_partial(&self) -> bool {
+		self.offset < self.data.len()
+	}
+}
+
 pub enum Channel {
 	Mpsc {
 		rx: UnboundedReceiver<Downstream>,
 		tx: UnboundedSender<Upstream>,
 	},
-	Tcp(TcpStream),
+	Tcp {
+		stream: TcpStream,
+		buf: FrameBuf,
+		// frames not yet accepted by the non-blocking socket, written out on
+		// the next send or recv
+		out: Vec<u8>,
+		ring: Option<(Ring, FrameBuf)>,
+	},
 }
 
 impl Channel {
 	pub fn connect(port: u16) -> Result<Self> {
 		let stream = TcpStream::connect((Ipv4Addr::LOCALHOST, port))?;
 		stream.set_nonblocking(true)?;
-		Ok(Self::Tcp(stream))
+		stream.set_nodelay(true)?;
+		let mut this = Self::Tcp {
+			stream,
+			buf: FrameBuf::default(),
+			out: Vec::new(),
+			ring: None,
+		};
+
+		// downstream moves to a shared memory ring when one can be created,
+		// otherwise it stays on the socket
+		match Ring::create() {
+			Ok((ring, name)) => {
+				this.send(Upstream::Ring { name })?;
+				if let Self::Tcp { ring: slot, .. } = &mut this {
+					*slot = Some((ring, FrameBuf::default()));
+				}
+			},
+			Err(err) => warn!("failed to create ring: {err}"),
+		}
+
+		Ok(this)
 	}
 
 	pub fn send(&mut self, message: Upstream) -> Result<()> {
@@ -120,17 +382,66 @@ impl Channel {
 			Self::Mpsc { tx, .. } => {
 				tx.send(message)?;
 			},
-			Self::Tcp(stream) => {
-				let n = bincode::serialized_size(&message)? as u32;
-				stream.write_all(&n.to_le_bytes())?;
-				bincode::serialize_into(stream, &message)?;
+			Self::Tcp { stream, out, .. } => {
+				if out.len() > MAX_FRAME {
+					bail!("server is not reading");
+				}
+
+				out.extend_from_slice(&frame(&message)?);
+				Self::flush(stream, out)?;
 			},
 		}
 
 		Ok(())
 	}
 
-	pub fn recv(&mut self) -> Result<Option<Downstream>> {
+	// writes as much of out as the socket accepts without blocking
+	fn flush(stream: &mut TcpStream, out: &mut Vec<u8>) -> Result<()> {
+		let mut written = 0;
+		while written < out.len() {
+			match stream.write(&out[written..]) {
+				Ok(0) => bail!("disconnected"),
+				Ok(n) => written += n,
+				Err(err) if err.kind() == ErrorKind::WouldBlock => break,
+				Err(err) if err.kind() == ErrorKind::Interrupted => (),
+				Err(err) => return Err(err.into()),
+			}
+		}
+
+		out.drain(..written);
+		Ok(())
+	}
+
+	// whether anything is left to receive
+	pub fn is_pending(&mut self) -> Result<bool> {
+		match self {
+			Self::Mpsc { rx, .. } => Ok(!rx.is_empty()),
+			Self::Tcp {
+				stream, buf, ring, ..
+			} => {
+				if buf.is_partial() {
+					return Ok(true)
+				}
+
+				if let Some((ring, buf)) = ring {
+					if buf.is_partial() || !ring.is_empty() {
+						return Ok(true)
+					}
+				}
+
+				let mut byte = [0];
+				match stream.peek(&mut byte) {
+					Ok(n) => Ok(n > 0),
+					Err(err) if err.kind() == ErrorKind::WouldBlock => Ok(false),
+					Err(err) => Err(err.into()),
+				}
+			},
+		}
+	}
+
+	// only blocks for the rest of a frame already arriving through the ring,
+	// and no later than the deadline
+	pub fn recv(&mut self, deadline: Instant) -> Result<Option<Downstream>> {
 		match self {
 			Self::Mpsc { rx, .. } => match rx.try_recv() {
 				Ok(message) => {
@@ -140,18 +451,54 @@ impl Channel {
 				Err(TryRecvError::Empty) => Ok(None),
 				Err(_) => bail!("disconnected"),
 			},
-			Self::Tcp(stream) => {
-				let mut buf = [0];
-				match stream.peek(&mut buf) {
-					Ok(0) => return Ok(None),
-					Ok(_) => (),
-					Err(err) if err.kind() == ErrorKind::WouldBlock => return Ok(None),
-					Err(err) => return Err(err.into()),
+			Self::Tcp {
+				stream,
+				buf,
+				out,
+				ring,
+			} => {
+				Self::flush(stream, out)?;
+
+				// the server uses the ring once it has opened it, and the socket
+				// before or if it could not, so only one of them carries frames
+				if let Some((ring, buf)) = ring {
+					loop {
+						if let Some(message) = buf.take()? {
+							trace!("cch rx: {:?}", HideConfig(&message));
+							return Ok(Some(message))
+						}
+
+						ring.read(|bytes| buf.extend(bytes))?;
+						if let Some(message) = buf.take()? {
+							trace!("cch rx: {:?}", HideConfig(&message));
+							return Ok(Some(message))
+						}
+
+						// a frame larger than the ring comes in pieces, each passed
+						// once the previous one has been read
+						let left = deadline.saturating_duration_since(Instant::now());
+						if !buf.is_partial() || left.is_zero() {
+							break
+						}
+
+						ring.wait_data(left.as_millis().max(1) as u32);
+					}
 				}
 
-				let message = bincode::deserialize_from(stream)?;
-				trace!("cch rx: {:?}", HideConfig(&message));
-				Ok(Some(message))
+				loop {
+					if let Some(message) = buf.take()? {
+						trace!("cch rx: {:?}", HideConfig(&message));
+						return Ok(Some(message))
+					}
+
+					let mut chunk = [0; 0x4000];
+					match stream.read(&mut chunk) {
+						Ok(0) => return Ok(None),
+						Ok(n) => buf.extend(&chunk[..n]),
+						Err(err) if err.kind() == ErrorKind::WouldBlock => return Ok(None),
+						Err(err) => return Err(err.into()),
+					}
+				}
 			},
 		}
 	}
@@ -185,11 +532,24 @@ impl ServerChannel {
 		tx: &mut T,
 		message: Downstream,
 	) -> Result<()> {
-		let data = bincode::serialize(&message)?;
-		tx.write_all(&data).await?;
+		tx.write_all(&frame(&message)?).await?;
 		Ok(())
 	}
 
+	async fn send_ring(ring: &Arc<Ring>, mut frame: &[u8]) -> Result<()> {
+		loop {
+			frame = &frame[ring.write(frame)?..];
+			if frame.is_empty() {
+				return Ok(())
+			}
+
+			// the ring is full, so wait off the runtime for the reader
+			let ring = ring.clone();
+			tokio::task::spawn_blocking(move || ring.wait_space(RING_WAIT_MS))
+				.await?;
+		}
+	}
+
 	/* pub async fn recv(&mut self) -> Result<Upstream> {
 		match self {
 			Self::Mpsc { rx, .. } => Self::recv_mpsc(rx).await,
@@ -209,7 +569,7 @@ impl ServerChannel {
 
 	async fn recv_tcp<T: AsyncReadExt + Unpin>(rx: &mut T) -> Result<Upstream> {
 		let n = rx.read_u32_le().await?;
-		if n > 0x100_0000 {
+		if n as usize > MAX_FRAME {
 			bail!("oversized packet");
 		} else {
 			let mut buf = vec![0; n as usize];
@@ -226,27 +586,40 @@ impl ServerChannel {
 			),
 			Self::Tcp(stream) => {
 				let (rx, tx) = stream.into_split();
+				let ring = RingSlot::default();
 				(
-					ServerChannelReadHalf::Tcp(rx),
-					ServerChannelWriteHalf::Tcp(tx),
+					ServerChannelReadHalf::Tcp(rx, ring.clone()),
+					ServerChannelWriteHalf::Tcp(tx, ring),
 				)
 			},
 		}
 	}
 }
 
+// the ring a tcp client asked for, opened by the read half and used by the
+// write half
+type RingSlot = Arc<OnceLock<Arc<Ring>>>;
+
 pub enum ServerChannelReadHalf {
 	Mpsc(UnboundedReceiver<Upstream>),
-	Tcp(OwnedReadHalf),
+	Tcp(OwnedReadHalf, RingSlot),
 }
 
 impl ServerChannelReadHalf {
 	pub async fn recv(&mut self) -> Result<Upstream> {
 		let message = match self {
 			Self::Mpsc(rx) => ServerChannel::recv_mpsc(rx).await,
-			Self::Tcp(rx) => {
+			Self::Tcp(rx, ring) => loop {
 				rx.readable().await?;
-				ServerChannel::recv_tcp(rx).await
+				match ServerChannel::recv_tcp(rx).await? {
+					Upstream::Ring { name } => match Ring::open(&name) {
+						Ok(opened) => {
+							let _ = ring.set(Arc::new(opened));
+						},
+						Err(err) => warn!("failed to open ring: {err}"),
+					},
+					message => break Ok(message),
+				}
 			},
 		}?;
 		trace!("sch rx: {message:?}");
@@ -256,7 +629,7 @@ impl ServerChannelReadHalf {
 
 pub enum ServerChannelWriteHalf {
 	Mpsc(UnboundedSender<Downstream>),
-	Tcp(OwnedWriteHalf),
+	Tcp(OwnedWriteHalf, RingSlot),
 }
 
 impl ServerChannelWriteHalf {
@@ -264,8 +637,38 @@ impl ServerChannelWriteHalf {
 		trace!("sch tx: {:?}", HideConfig(&message));
 
 		match self {
-			Self::Mpsc(tx) => ServerChannel::send_mpsc(tx, message).await,
-			Self::Tcp(tx) => ServerChannel::send_tcp(tx, message).await,
+			Self::Mpsc(tx) => {
+				// build the aerodrome here rather than on the UI thread
+				let message = match message {
+					Downstream::Config { data } => {
+						Downstream::Prepared(Prepared(Box::new(Aerodrome::new(data))))
+					},
+					message => message,
+				};
+
+				ServerChannel::send_mpsc(tx, message).await
+			},
+			Self::Tcp(tx, ring) => match ring.get() {
+				Some(ring) => ServerChannel::send_ring(ring, &frame(&message)?).await,
+				None => ServerChannel::send_tcp(tx, message).await,
+			},
+		}
+	}
+
+	pub async fn send_shared(&mut self, message: &Shared) -> Result<()> {
+		match self {
+			Self::Mpsc(_) => self.send(message.message().clone()).await,
+			Self::Tcp(tx, ring) => {
+				trace!("sch tx: {:?}", HideConfig(message.message()));
+				let frame = message.frame()?;
+				match ring.get() {
+					Some(ring) => ServerChannel::send_ring(ring, &frame).await,
+					None => {
+						tx.write_all(&frame).await?;
+						Ok(())
+					},
+				}
+			},
 		}
 	}
 }
@@ -1,10 +1,17 @@
 mod api;
+#[cfg(feature = "bench")]
+pub mod bench;
+mod bitset;
 mod client;
 mod config;
 mod context;
 mod ipc;
+mod pool;
+mod ring;
 mod screen;
 mod server;
+mod stats;
+mod timer;
 
 use serde::{Deserialize, Serialize};
 
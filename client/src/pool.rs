@@ -0,0 +1,119 @@
+use std::panic::{self, AssertUnwindSafe};
+use std::sync::mpsc::{self, Receiver, Sender};
+use std::sync::{Arc, Mutex, OnceLock};
+use std::thread;
+
+const MAX_WORKERS: usize = 3;
+
+type Job = Box<dyn FnOnce() + Send + 'static>;
+pub type Task<'a> = Box<dyn FnOnce() + Send + 'a>;
+
+// a few threads started on first use and kept for the life of the process,
+// so that work split off the ui thread does not pay for spawning threads
+struct Pool {
+	sender: Mutex<Sender<Job>>,
+	workers: usize,
+}
+
+fn pool() -> &'static Pool {
+	static POOL: OnceLock<Pool> = OnceLock::new();
+
+	POOL.get_or_init(|| {
+		let workers = thread::available_parallelism()
+			.map_or(1, |n| n.get())
+			.saturating_sub(1)
+			.min(MAX_WORKERS);
+
+		let (sender, receiver) = mpsc::channel::<Job>();
+		let receiver = Arc::new(Mutex::new(receiver));
+
+		let spawned = (0..workers)
+			.filter(|i| {
+				let receiver = receiver.clone();
+				thread::Builder::new()
+					.name(format!("bars-worker-{i}"))
+					.spawn(move || loop {
+						let job = receiver.lock().unwrap().recv();
+						match job {
+							Ok(job) => job(),
+							Err(_) => return,
+						}
+					})
+					.is_ok()
+			})
+			.count();
+
+		Pool {
+			sender: Mutex::new(sender),
+			workers: spawned,
+		}
+	})
+}
+
+// how many tasks can run at once, counting the calling thread
+pub fn threads() -> usize {
+	pool().workers + 1
+}
+
+// runs every task, the first on the calling thread and the rest on the pool,
+// and returns once all of them have finished
+pub fn run(tasks: Vec<Task<'_>>) {
+	let mut tasks = tasks.into_iter();
+	let Some(first) = tasks.next() else { return };
+
+	let (done, receiver) = mpsc::channel();
+	let mut wait = Wait {
+		receiver,
+		pending: 0,
+		panicked: false,
+	};
+
+	{
+		let sender = pool().sender.lock().unwrap();
+
+		for task in tasks {
+			let done = done.clone();
+			let job: Task = Box::new(move || {
+				let result = panic::catch_unwind(AssertUnwindSafe(task));
+				let _ = done.send(result.is_err());
+			});
+
+			// the job may borrow from the caller, which is sound because wait
+			// blocks until it has run, even if the caller unwinds first
+			let job: Job = unsafe { std::mem::transmute::<Task, Job>(job) };
+
+			match sender.send(job) {
+				Ok(()) => wait.pending += 1,
+				Err(err) => (err.0)(),
+			}
+		}
+	}
+
+	first();
+	wait.finish();
+
+	if wait.panicked {
+		panic!("pool task panicked");
+	}
+}
+
+struct Wait {
+	receiver: Receiver<bool>,
+	pending: usize,
+	panicked: bool,
+}
+
+impl Wait {
+	fn finish(&mut self) {
+		while self.pending > 0 {
+			self.pending -= 1;
+			self.panicked |= self.receiver.recv().unwrap_or(true);
+		}
+	}
+}
+
+impl Drop for Wait {
+	fn drop(&mut self) {
+		self.finish();
+	}
+}
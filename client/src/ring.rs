@@ -0,0 +1,309 @@
+use std::slice;
+use std::sync::atomic::{AtomicU32, AtomicU64, Ordering};
+
+use anyhow::{bail, Result};
+
+use windows::core::PCWSTR;
+use windows::Win32::Foundation::{CloseHandle, HANDLE, INVALID_HANDLE_VALUE};
+use windows::Win32::System::Memory::{
+	CreateFileMappingW, MapViewOfFile, OpenFileMappingW, UnmapViewOfFile,
+	FILE_MAP_ALL_ACCESS, MEMORY_MAPPED_VIEW_ADDRESS, PAGE_READWRITE,
+};
+use windows::Win32::System::Threading::{
+	CreateEventW, OpenEventW, SetEvent, WaitForSingleObject, EVENT_MODIFY_STATE,
+	SYNCHRONIZATION_SYNCHRONIZE,
+};
+
+const PREFIX: &str = "Local\\bars-";
+const HEADER: usize = 64;
+const CAPACITY: usize = 0x40_0000;
+
+// shared between both ends, at the start of the mapping. the counters are
+// totals, so their difference is the number of bytes waiting to be read.
+#[repr(C)]
+struct Header {
+	written: AtomicU64,
+	read: AtomicU64,
+	// set by either end when it goes away
+	closed: AtomicU32,
+	// set by the writer while it waits for the reader to make space
+	waiting: AtomicU32,
+	// set by the reader while it waits for the rest of a frame
+	reading: AtomicU32,
+}
+
+// a byte pipe through named shared memory, from the proxy server to one
+// client in another instance. the client creates it and sends its name over
+// tcp, after which downstream frames are copied straight into the ring.
+//
+// each end can block on the other through an event: the writer on a full
+// ring until the reader catches up, and the reader on a frame larger than the
+// ring until the writer has passed the rest, so that it arrives within one
+// tick rather than one ring's worth per tick.
+pub struct Ring {
+	mapping: HANDLE,
+	space: HANDLE,
+	data: HANDLE,
+	view: MEMORY_MAPPED_VIEW_ADDRESS,
+}
+
+// the view is only accessed through the header atomics, with a single reader
+// and a single writer
+unsafe impl Send for Ring {}
+unsafe impl Sync for Ring {}
+
+fn wide(name: &str) -> Vec<u16> {
+	name.encode_utf16().chain([0]).collect()
+}
+
+unsafe fn close(handles: &[HANDLE]) {
+	for &handle in handles {
+		let _ = CloseHandle(handle);
+	}
+}
+
+impl Ring {
+	// creates a ring to read from, returning it with the name to open it by
+	pub fn create() -> Result<(Self, String)> {
+		static COUNTER: AtomicU32 = AtomicU32::new(0);
+
+		let name = format!(
+			"{PREFIX}{}-{}",
+			std::process::id(),
+			COUNTER.fetch_add(1, Ordering::Relaxed),
+		);
+
+		unsafe {
+			let mapping = CreateFileMappingW(
+				INVALID_HANDLE_VALUE,
+				None,
+				PAGE_READWRITE,
+				0,
+				(HEADER + CAPACITY) as u32,
+				PCWSTR(wide(&name).as_ptr()),
+			)?;
+
+			let create = |suffix: &str| {
+				let name = wide(&format!("{name}-{suffix}"));
+				CreateEventW(None, false, false, PCWSTR(name.as_ptr()))
+			};
+
+			let space = match create("space") {
+				Ok(event) => event,
+				Err(err) => {
+					close(&[mapping]);
+					return Err(err.into())
+				},
+			};
+
+			let data = match create("data") {
+				Ok(event) => event,
+				Err(err) => {
+					close(&[space, mapping]);
+					return Err(err.into())
+				},
+			};
+
+			Ok((Self::map(mapping, space, data)?, name))
+		}
+	}
+
+	// opens a ring created by a client, to write to
+	pub fn open(name: &str) -> Result<Self> {
+		if !name.starts_with(PREFIX) {
+			bail!("invalid ring name");
+		}
+
+		unsafe {
+			let mapping = OpenFileMappingW(
+				FILE_MAP_ALL_ACCESS.0,
+				false,
+				PCWSTR(wide(name).as_ptr()),
+			)?;
+
+			let open = |suffix: &str| {
+				let name = wide(&format!("{name}-{suffix}"));
+				OpenEventW(
+					EVENT_MODIFY_STATE | SYNCHRONIZATION_SYNCHRONIZE,
+					false,
+					PCWSTR(name.as_ptr()),
+				)
+			};
+
+			let space = match open("space") {
+				Ok(event) => event,
+				Err(err) => {
+					close(&[mapping]);
+					return Err(err.into())
+				},
+			};
+
+			let data = match open("data") {
+				Ok(event) => event,
+				Err(err) => {
+					close(&[space, mapping]);
+					return Err(err.into())
+				},
+			};
+
+			Self::map(mapping, space, data)
+		}
+	}
+
+	unsafe fn map(mapping: HANDLE, space: HANDLE, data: HANDLE) -> Result<Self> {
+		let view =
+			MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, HEADER + CAPACITY);
+
+		if view.Value.is_null() {
+			close(&[data, space, mapping]);
+			bail!("failed to map ring");
+		}
+
+		Ok(Self {
+			mapping,
+			space,
+			data,
+			view,
+		})
+	}
+
+	fn header(&self) -> &Header {
+		unsafe { &*(self.view.Value as *const Header) }
+	}
+
+	fn bytes(&self) -> *mut u8 {
+		unsafe { (self.view.Value as *mut u8).add(HEADER) }
+	}
+
+	// passes everything waiting in the ring to f, in at most two slices
+	pub fn read(&self, mut f: impl FnMut(&[u8])) -> Result<()> {
+		let header = self.header();
+
+		// loaded first, so that data written before the writer closed is seen
+		let closed = header.closed.load(Ordering::Acquire) != 0;
+		let written = header.written.load(Ordering::Acquire);
+		let read = header.read.load(Ordering::Relaxed);
+
+		// the header is writable by the other process, so counters that could
+		// only come from a broken or hostile writer end the channel rather than
+		// reach outside the mapping
+		let n = match written.checked_sub(read) {
+			Some(n) if n as usize <= CAPACITY => n as usize,
+			_ => {
+				header.closed.store(1, Ordering::Release);
+				bail!("corrupt ring");
+			},
+		};
+
+		if n == 0 {
+			if closed {
+				bail!("disconnected");
+			}
+
+			return Ok(())
+		}
+
+		let start = read as usize % CAPACITY;
+		let first = n.min(CAPACITY - start);
+
+		unsafe {
+			f(slice::from_raw_parts(self.bytes().add(start), first));
+			f(slice::from_raw_parts(self.bytes(), n - first));
+		}
+
+		// read only moves forward from here, checked above against written
+		header.read.store(read + n as u64, Ordering::SeqCst);
+
+		if header.waiting.load(Ordering::SeqCst) != 0 {
+			let _ = unsafe { SetEvent(self.space) };
+		}
+
+		Ok(())
+	}
+
+	pub fn is_empty(&self) -> bool {
+		let header = self.header();
+		header.written.load(Ordering::Acquire)
+			== header.read.load(Ordering::Relaxed)
+	}
+
+	// blocks until the writer passes more data, or the timeout ends
+	pub fn wait_data(&self, timeout_ms: u32) {
+		let header = self.header();
+
+		header.reading.store(1, Ordering::SeqCst);
+
+		// the writer may have written before it could see the flag
+		let read = header.read.load(Ordering::Relaxed);
+		if header.written.load(Ordering::SeqCst) == read {
+			unsafe { WaitForSingleObject(self.data, timeout_ms) };
+		}
+
+		header.reading.store(0, Ordering::SeqCst);
+	}
+
+	// copies as much of data as fits, returning how many bytes were written
+	pub fn write(&self, data: &[u8]) -> Result<usize> {
+		let header = self.header();
+
+		if header.closed.load(Ordering::Acquire) != 0 {
+			bail!("disconnected");
+		}
+
+		let written = header.written.load(Ordering::Relaxed);
+		let read = header.read.load(Ordering::Acquire);
+
+		let free = match written.checked_sub(read) {
+			Some(n) if n as usize <= CAPACITY => CAPACITY - n as usize,
+			_ => {
+				header.closed.store(1, Ordering::Release);
+				bail!("corrupt ring");
+			},
+		};
+
+		let n = data.len().min(free);
+		let start = written as usize % CAPACITY;
+		let first = n.min(CAPACITY - start);
+
+		unsafe {
+			let (src, dst) = (data.as_ptr(), self.bytes());
+			dst.add(start).copy_from_nonoverlapping(src, first);
+			dst.copy_from_nonoverlapping(src.add(first), n - first);
+		}
+
+		header.written.store(written + n as u64, Ordering::SeqCst);
+
+		if n > 0 && header.reading.load(Ordering::SeqCst) != 0 {
+			let _ = unsafe { SetEvent(self.data) };
+		}
+
+		Ok(n)
+	}
+
+	// blocks until the reader frees space in a full ring, or the timeout ends
+	pub fn wait_space(&self, timeout_ms: u32) {
+		let header = self.header();
+
+		header.waiting.store(1, Ordering::SeqCst);
+
+		// the reader may have caught up before it could see the flag
+		let written = header.written.load(Ordering::Relaxed);
+		let read = header.read.load(Ordering::SeqCst);
+		if written.wrapping_sub(read) as usize >= CAPACITY {
+			unsafe { WaitForSingleObject(self.space, timeout_ms) };
+		}
+
+		header.waiting.store(0, Ordering::SeqCst);
+	}
+}
+
+impl Drop for Ring {
+	fn drop(&mut self) {
+		self.header().closed.store(1, Ordering::Release);
+
+		unsafe {
+			let _ = UnmapViewOfFile(self.view);
+			close(&[self.data, self.space, self.mapping]);
+		}
+	}
+}
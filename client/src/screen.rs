@@ -1,22 +1,33 @@
 use crate::client::Aerodrome;
 use crate::context::Context;
+use crate::pool;
+use crate::stats::{FrameStats, Histogram};
 use crate::{ActivityState, ClickType, ViewportGeo, ViewportNonGeo};
 
+use std::collections::HashMap;
 use std::fmt::Debug;
+use std::ops::Range;
+use std::rc::{Rc, Weak};
 use std::time::{Duration, Instant};
 
 use bars_config::{
-	BlockDisplay, BlockState, Color, EdgeCondition, EdgeDisplay, FillStyle, Geo,
-	GeoPoint, NodeCondition, NodeDisplay, Path, Point,
+	BlockDisplay, BlockState, Color, EdgeDisplay, FillStyle, Geo, GeoPoint,
+	NodeCondition, NodeDisplay, Path, Point, LOD_TOLERANCES,
 };
 
 use tracing::{trace, warn};
 
 use windows::Win32::Foundation::{COLORREF, POINT, RECT};
-use windows::Win32::Graphics::Gdi::{self, HBRUSH, HDC, HPEN};
+use windows::Win32::Graphics::Gdi::{
+	self, HBITMAP, HBRUSH, HDC, HGDIOBJ, HPEN,
+};
 
 const DESELECT_AFTER: Duration = Duration::from_secs(3);
 
+// the plugin keys this colour out when compositing the foreground layer (see
+// COLOR_FOREGROUND_KEY in screen.cpp), so styles must never draw with it
+const FOREGROUND_KEY: u32 = 0xfe00fe;
+
 #[derive(Clone, Copy, Default)]
 enum Target {
 	#[default]
@@ -34,9 +45,15 @@ struct Style {
 impl Style {
 	unsafe fn new(style: &bars_config::Style) -> Self {
 		fn color(color: Color) -> COLORREF {
-			COLORREF(
-				((color.b as u32) << 16) | ((color.g as u32) << 8) | color.r as u32,
-			)
+			let value =
+				((color.b as u32) << 16) | ((color.g as u32) << 8) | color.r as u32;
+
+			// nudge the key by one step of blue so it stays visible
+			if value == FOREGROUND_KEY {
+				COLORREF(value ^ 0x010000)
+			} else {
+				COLORREF(value)
+			}
 		}
 
 		let brush = if style.fill_style == FillStyle::None {
@@ -90,15 +107,95 @@ impl Drop for Style {
 	}
 }
 
+// the static base layer of a non-geo view, rendered once into a dib section
+// and copied to the screen until the aerodrome instance, view or viewport
+// size changes
+pub struct Background {
+	key: (u64, usize, i32, i32),
+	pub dc: HDC,
+	bitmap: HBITMAP,
+	previous: HGDIOBJ,
+}
+
+impl Background {
+	// compatible with hdc, or with the screen if none is given
+	pub unsafe fn new(
+		hdc: Option<HDC>,
+		key: (u64, usize, i32, i32),
+	) -> Option<Self> {
+		let (_, _, width, height) = key;
+
+		let info = Gdi::BITMAPINFO {
+			bmiHeader: Gdi::BITMAPINFOHEADER {
+				biSize: std::mem::size_of::<Gdi::BITMAPINFOHEADER>() as u32,
+				biWidth: width,
+				biHeight: -height,
+				biPlanes: 1,
+				biBitCount: 32,
+				biCompression: Gdi::BI_RGB.0,
+				..Default::default()
+			},
+			..Default::default()
+		};
+
+		let mut bits = std::ptr::null_mut();
+		let bitmap = Gdi::CreateDIBSection(
+			hdc,
+			&info,
+			Gdi::DIB_RGB_COLORS,
+			&mut bits,
+			None,
+			0,
+		)
+		.ok()?;
+
+		let dc = Gdi::CreateCompatibleDC(hdc);
+		if dc.is_invalid() {
+			let _ = Gdi::DeleteObject(bitmap.into());
+			return None
+		}
+
+		let previous = Gdi::SelectObject(dc, bitmap.into());
+
+		Some(Self {
+			key,
+			dc,
+			bitmap,
+			previous,
+		})
+	}
+
+	unsafe fn blit(&self, hdc: HDC) {
+		let (_, _, width, height) = self.key;
+		let _ =
+			Gdi::BitBlt(hdc, 0, 0, width, height, Some(self.dc), 0, 0, Gdi::SRCCOPY);
+	}
+}
+
+impl Drop for Background {
+	fn drop(&mut self) {
+		unsafe {
+			Gdi::SelectObject(self.dc, self.previous);
+			let _ = Gdi::DeleteDC(self.dc);
+			let _ = Gdi::DeleteObject(self.bitmap.into());
+		}
+	}
+}
+
 pub struct Screen<'a> {
 	context: &'a mut Context,
 	icao: Option<String>,
 	view: Option<usize>,
 	transform: Transform,
-	targets: Option<Lookup2d<Target>>,
+	size: [f64; 2],
+	targets: Option<TargetIndex>,
+	targets_key: Option<TargetsKey>,
 	click_regions: Vec<RECT>,
 	selected: Option<(usize, Instant)>,
-	styles: Vec<Style>,
+	scene: Option<Scene>,
+	stats: Stats,
+	foreground: Option<ForegroundKey>,
+	background: Option<Background>,
 	refresh_required: bool,
 	last_controlling: bool,
 	last_data: bool,
@@ -112,10 +209,15 @@ impl<'a> Screen<'a> {
 			icao: None,
 			view: (!geo).then_some(0),
 			transform: Transform::new(),
+			size: [0.0; 2],
 			targets: None,
+			targets_key: None,
 			click_regions: Vec::new(),
 			selected: None,
-			styles: Vec::new(),
+			scene: None,
+			stats: Stats::default(),
+			foreground: None,
+			background: None,
 			refresh_required: true,
 			last_controlling: false,
 			last_data: false,
@@ -147,6 +249,10 @@ impl Screen<'_> {
 		self.icao.as_ref().map(|s| s.as_str())
 	}
 
+	pub fn instance(&self) -> Option<u64> {
+		self.data().map(|aerodrome| aerodrome.instance())
+	}
+
 	pub fn set_aerodrome(&mut self, icao: Option<&str>) {
 		if let Some(icao) = &self.icao {
 			self.context.untrack_aerodrome(icao);
@@ -158,9 +264,12 @@ impl Screen<'_> {
 		self.icao = icao.map(|s| s.to_string());
 
 		if let Some(targets) = self.targets.as_mut() {
-			targets.clear(Target::None);
+			targets.clear();
 		}
-		self.styles.clear();
+		self.targets_key = None;
+		self.scene = None;
+		self.foreground = None;
+		self.background = None;
 
 		self.refresh_required = true;
 		self.last_controlling = false;
@@ -256,6 +365,7 @@ impl Screen<'_> {
 	pub fn set_view(&mut self, i: usize) {
 		if let Some(view) = self.view.as_mut() {
 			*view = i;
+			self.foreground = None;
 			self.refresh_required = true;
 		}
 	}
@@ -267,53 +377,30 @@ impl Screen<'_> {
 			.unwrap_or(false)
 	}
 
-	fn load_styles(&mut self) {
-		self.styles = if let Some(data) = self.data() {
-			data
-				.config()
-				.styles
-				.iter()
-				.map(|style| unsafe { Style::new(style) })
-				.collect()
-		} else {
-			return
-		};
-	}
-
-	fn project_points<T: Transformable>(&self, points: &[T]) -> Vec<(f64, f64)> {
-		points
-			.iter()
-			.map(|p| p.transform(&self.transform))
-			.collect()
-	}
+	fn load_scene(&mut self) {
+		let Some(aerodrome) = self.data() else { return };
 
-	unsafe fn draw_path<T: Clone + Debug + Transformable>(
-		&self,
-		hdc: HDC,
-		path: &Path<T>,
-	) {
-		if path.style >= self.styles.len() {
+		if self.scene.as_ref().is_some_and(|scene| {
+			scene.data.instance == aerodrome.instance()
+				&& scene.data.view == self.view
+		}) {
 			return
 		}
 
-		let style = &self.styles[path.style];
-		style.apply(hdc);
+		let Some(icao) = &self.icao else { return };
+		let Some(data) = self.context.load_scene(icao, self.view) else {
+			return
+		};
 
-		let points = path
-			.points
-			.iter()
-			.map(|p| p.transform(&self.transform))
-			.map(|(x, y)| POINT {
-				x: x.round() as i32,
-				y: y.round() as i32,
-			})
-			.collect::<Vec<_>>();
+		self.scene = Some(Scene::new(data));
+		self.foreground = None;
+	}
 
-		if style.filled {
-			let _ = Gdi::Polygon(hdc, points.as_slice());
-		} else {
-			let _ = Gdi::Polyline(hdc, points.as_slice());
-		}
+	fn project_points<'a, T: Transformable>(
+		&'a self,
+		points: &'a [T],
+	) -> impl Iterator<Item = (f64, f64)> + 'a {
+		points.iter().map(|p| p.transform(&self.transform))
 	}
 
 	fn setup_targets<'a, T: Clone + Debug + Transformable + 'a>(
@@ -321,33 +408,46 @@ impl Screen<'_> {
 		size: [f64; 2],
 		nodes: impl Iterator<Item = &'a NodeDisplay<T>>,
 		blocks: impl Iterator<Item = &'a BlockDisplay<T>>,
-		targets: &mut Lookup2d<Target>,
+		targets: &mut TargetIndex,
 	) {
 		let width = size[0].round() as usize;
 		let height = size[1].round() as usize;
 
-		if targets.width == width && targets.data.len() == width * height {
-			targets.clear(Target::None);
-		} else {
-			*targets = Lookup2d::new(Target::None, width, height);
-		}
+		targets.reset(width, height);
+
+		let visible = self.transform.visible(size);
+		let is_visible = |target: &bars_config::Target<T>| {
+			let bounds = SourceBox::new(&target.bounds);
+			visible.map_or(true, |v| v.intersects(&bounds))
+		};
 
 		for (i, block) in blocks.enumerate() {
-			let points = self.project_points(&block.target.points);
-			targets.add_poly(Target::Block(i as u16), &points);
+			if is_visible(&block.target) {
+				let points = self.project_points(&block.target.points);
+				targets.add(Target::Block(i as u16), points);
+			}
 		}
 
 		let Some(aerodrome) = self.data() else { return };
-		let profile = &aerodrome.config().profiles[aerodrome.profile()];
 
 		for (i, node) in nodes.enumerate() {
-			if !matches!(profile.nodes[i], NodeCondition::Fixed { .. }) {
+			if !aerodrome.is_node_fixed(i) && is_visible(&node.target) {
 				let points = self.project_points(&node.target.points);
-				targets.add_poly(Target::Node(i as u16), &points);
+				targets.add(Target::Node(i as u16), points);
 			}
 		}
 	}
 
+	fn targets_key(&self) -> Option<TargetsKey> {
+		self.data().map(|aerodrome| TargetsKey {
+			instance: aerodrome.instance(),
+			revision: aerodrome.revision(),
+			controlling: aerodrome.state() == ActivityState::Controlling,
+			transform: self.transform,
+			size: self.size,
+		})
+	}
+
 	fn is_controlling(&self) -> bool {
 		self
 			.data()
@@ -355,20 +455,48 @@ impl Screen<'_> {
 			.unwrap_or_default()
 	}
 
-	pub fn draw_background_geo(&mut self, _hdc: HDC, viewport: ViewportGeo) {
+	pub fn draw_background_geo(&mut self, hdc: HDC, viewport: ViewportGeo) {
+		let instant_start = Instant::now();
+
+		self.stats.background_calls = 0;
+		self.render_background_geo(hdc, viewport);
+
+		self.stats.background.record(instant_start.elapsed());
+		trace!("bg {:?}", instant_start.elapsed());
+	}
+
+	pub fn draw_background_non_geo(
+		&mut self,
+		hdc: HDC,
+		viewport: ViewportNonGeo,
+	) {
+		let instant_start = Instant::now();
+
+		self.stats.background_calls = 0;
+		self.render_background_non_geo(hdc, viewport);
+
+		self.stats.background.record(instant_start.elapsed());
+		trace!("bg {:?}", instant_start.elapsed());
+	}
+
+	fn render_background_geo(&mut self, _hdc: HDC, viewport: ViewportGeo) {
 		const CELL_SIZE: usize = 20;
 		const THRESHOLD: usize = 100;
 
-		let instant_start = std::time::Instant::now();
-
 		let _ = self.is_background_refresh_required();
 
-		if self.styles.is_empty() {
-			self.load_styles();
+		self.load_scene();
+		self.set_viewport_geo(viewport);
+
+		// targets only depend on the transform and aerodrome state, so frames
+		// where neither changed keep the previous targets and click regions
+		let key = self.targets_key();
+		if key.is_some() && key == self.targets_key && self.targets.is_some() {
+			return
 		}
 
+		self.targets_key = key;
 		self.click_regions.clear();
-		self.transform = Transform::new_geo(viewport);
 
 		if !self.is_controlling() {
 			return
@@ -378,18 +506,20 @@ impl Screen<'_> {
 
 		let Some(aerodrome) = self.data() else { return };
 
+		let instant_targets = Instant::now();
 		self.setup_targets(
 			viewport.size,
 			aerodrome.config().nodes.iter().map(|node| &node.display),
 			aerodrome.config().blocks.iter().map(|block| &block.display),
 			&mut targets,
 		);
-
-		// this isn't very good
+		self.stats.targets.record(instant_targets.elapsed());
 
 		let width = viewport.size[0].round() as usize;
 		let height = viewport.size[1].round() as usize;
 
+		let coverage = targets.coverage(CELL_SIZE);
+
 		for by in 0..height / CELL_SIZE {
 			let cy = by * CELL_SIZE;
 
@@ -398,19 +528,7 @@ impl Screen<'_> {
 			for bx in 0..width / CELL_SIZE {
 				let cx = bx * CELL_SIZE;
 
-				let mut n = 0;
-				'a: for x in 0..CELL_SIZE {
-					for y in 0..CELL_SIZE {
-						if !matches!(targets.sample(cx + x, cy + y), Target::None) {
-							n += 1;
-							if n > THRESHOLD {
-								break 'a
-							}
-						}
-					}
-				}
-
-				if n <= THRESHOLD {
+				if coverage[by * (width / CELL_SIZE) + bx] <= THRESHOLD {
 					if startx < bx {
 						self.click_regions.push(RECT {
 							left: (startx * CELL_SIZE) as i32,
@@ -434,23 +552,16 @@ impl Screen<'_> {
 			}
 		}
 
-		self.targets = Some(targets);
+		merge_regions(&mut self.click_regions);
 
-		trace!("bg {:?}", instant_start.elapsed());
+		self.targets = Some(targets);
 	}
 
-	pub fn draw_background_non_geo(
-		&mut self,
-		hdc: HDC,
-		viewport: ViewportNonGeo,
-	) {
-		let instant_start = std::time::Instant::now();
-
+	fn render_background_non_geo(&mut self, hdc: HDC, viewport: ViewportNonGeo) {
 		let _ = self.is_background_refresh_required();
 
-		if self.styles.is_empty() {
-			self.load_styles();
-		}
+		self.load_scene();
+		self.set_viewport_non_geo(viewport);
 
 		self.click_regions.clear();
 
@@ -470,6 +581,7 @@ impl Screen<'_> {
 			return
 		};
 
+		let instant_targets = Instant::now();
 		self.setup_targets(
 			viewport.size,
 			aerodrome.config().maps[view.map]
@@ -483,53 +595,76 @@ impl Screen<'_> {
 			&mut targets,
 		);
 
-		self.transform = Transform::new_view(viewport, view.bounds);
+		let elapsed_targets = instant_targets.elapsed();
+
 		self.targets = Some(targets);
+		self.stats.targets.record(elapsed_targets);
+
+		let Some(scene) = self.scene.as_ref() else { return };
+		let key = (
+			scene.data.instance,
+			self.view.unwrap(),
+			viewport.size[0] as i32,
+			viewport.size[1] as i32,
+		);
 
-		let Some(aerodrome) = self.data() else { return };
-		let Some(view) = aerodrome.config().views.get(self.view.unwrap()) else {
-			return
-		};
+		if self.background.as_ref().map(|bg| bg.key) != Some(key) {
+			self.background = None;
+			if key.2 > 0 && key.3 > 0 {
+				self.background = unsafe { Background::new(Some(hdc), key) };
+			}
 
-		let map = &aerodrome.config().maps[view.map];
+			// draw straight to the screen if the bitmap could not be created
+			let dc = self.background.as_ref().map(|bg| bg.dc).unwrap_or(hdc);
 
-		unsafe {
-			Style::new(&bars_config::Style {
-				stroke_width: 0.0,
-				stroke_color: Color::default(),
-				fill_style: FillStyle::Solid,
-				fill_color: map.background,
-			})
-			.apply(hdc);
-			let _ = Gdi::Rectangle(
-				hdc,
-				viewport.origin[0] as i32,
-				viewport.origin[1] as i32,
-				viewport.size[0] as i32,
-				viewport.size[1] as i32,
-			);
-		}
+			let Some(mut scene) = self.scene.take() else { return };
+			scene.project(self.transform, self.size);
+
+			let Some(aerodrome) = self.data() else { return };
+			let Some(view) = aerodrome.config().views.get(self.view.unwrap()) else {
+				return
+			};
+
+			let map = &aerodrome.config().maps[view.map];
+
+			let mut batch = Batch::default();
+			batch.add(scene.data.base.clone());
 
-		for path in &map.base {
 			unsafe {
-				self.draw_path(hdc, path);
+				let style = Style::new(&bars_config::Style {
+					stroke_width: 0.0,
+					stroke_color: Color::default(),
+					fill_style: FillStyle::Solid,
+					fill_color: map.background,
+				});
+				style.apply(dc);
+				let _ = Gdi::Rectangle(dc, 0, 0, key.2, key.3);
+
+				batch.draw(dc, &scene);
 			}
+
+			self.scene = Some(scene);
+			self.stats.background_calls = batch.calls + 1;
 		}
 
-		trace!("bg {:?}", instant_start.elapsed());
+		if let Some(background) = &self.background {
+			unsafe {
+				background.blit(hdc);
+			}
+
+			self.stats.background_calls += 1;
+		}
 	}
 
-	fn draw_items<'a, T: Clone + Debug + Transformable + 'a>(
+	fn draw_items(
 		&self,
 		aerodrome: &Aerodrome,
-		nodes: impl Iterator<Item = &'a NodeDisplay<T>>,
-		edges: impl Iterator<Item = &'a EdgeDisplay<T>>,
+		scene: &Scene,
 		hdc: HDC,
+		batch: &mut Batch,
 	) {
-		for (i, edge) in edges.enumerate() {
-			if let EdgeCondition::Fixed { state: false } =
-				aerodrome.config().profiles[self.profile()].edges[i]
-			{
+		for (i, edge) in scene.data.edges.iter().enumerate() {
+			if aerodrome.is_edge_hidden(i) {
 				continue
 			}
 
@@ -539,21 +674,21 @@ impl Screen<'_> {
 				&edge.off
 			};
 
-			for path in display {
-				unsafe {
-					self.draw_path(hdc, path);
-				}
-			}
+			batch.add(display.clone());
 		}
 
-		for (i, node) in nodes.enumerate() {
+		unsafe {
+			batch.draw(hdc, scene);
+		}
+
+		let mut selected = None;
+
+		for (i, node) in scene.data.nodes.iter().enumerate() {
 			if aerodrome.config().nodes[i].parent.is_some() {
 				continue
 			}
 
-			if aerodrome.config().profiles[self.profile()].nodes[i]
-				== (NodeCondition::Fixed { state: false })
-			{
+			if aerodrome.is_node_hidden(i) {
 				continue
 			}
 
@@ -563,42 +698,64 @@ impl Screen<'_> {
 				&node.off
 			};
 
-			for path in display {
-				unsafe {
-					self.draw_path(hdc, path);
-				}
-			}
+			batch.add(display.clone());
 
 			if self.selected.map(|(n, _)| n == i).unwrap_or_default()
 				&& self.selected.unwrap().1.elapsed() < DESELECT_AFTER
 			{
-				for path in &node.selected {
-					unsafe {
-						self.draw_path(hdc, path);
-					}
-				}
+				selected = Some(node.selected.clone());
+			}
+		}
+
+		unsafe {
+			batch.draw(hdc, scene);
+		}
+
+		if let Some(paths) = selected {
+			batch.add(paths);
+
+			unsafe {
+				batch.draw(hdc, scene);
 			}
 		}
 	}
 
+	fn foreground_key(&self) -> ForegroundKey {
+		ForegroundKey {
+			revision: self.data().map(|aerodrome| aerodrome.revision()),
+			transform: self.transform,
+			size: self.size,
+			selected: self
+				.selected
+				.filter(|(_, at)| at.elapsed() < DESELECT_AFTER)
+				.map(|(node, _)| node),
+		}
+	}
+
+	pub fn is_foreground_dirty(&self) -> bool {
+		self.foreground != Some(self.foreground_key())
+	}
+
 	pub fn draw_foreground(&mut self, hdc: HDC) {
-		let instant_start = std::time::Instant::now();
+		let instant_start = Instant::now();
 
-		let Some(aerodrome) = self.data() else { return };
+		self.load_scene();
+		self.foreground = Some(self.foreground_key());
 
-		if let Some(view) = self.view {
-			let map = &aerodrome.config().maps[aerodrome.config().views[view].map];
+		let Some(mut scene) = self.scene.take() else { return };
+		scene.project(self.transform, self.size);
 
-			self.draw_items(aerodrome, map.nodes.iter(), map.edges.iter(), hdc);
-		} else {
-			self.draw_items(
-				aerodrome,
-				aerodrome.config().nodes.iter().map(|node| &node.display),
-				aerodrome.config().edges.iter().map(|edge| &edge.display),
-				hdc,
-			);
+		let mut batch = Batch::default();
+		if let Some(aerodrome) = self.data() {
+			self.draw_items(aerodrome, &scene, hdc, &mut batch);
 		}
 
+		self.scene = Some(scene);
+
+		self.stats.foreground_calls = batch.calls;
+		self.stats.foreground_points = batch.points_drawn;
+		self.stats.foreground.record(instant_start.elapsed());
+
 		if instant_start.elapsed() > Duration::from_millis(1) {
 			trace!("fg {:?}", instant_start.elapsed());
 		}
@@ -606,6 +763,7 @@ impl Screen<'_> {
 
 	pub fn set_viewport_geo(&mut self, viewport: ViewportGeo) {
 		self.transform = Transform::new_geo(viewport);
+		self.size = viewport.size;
 	}
 
 	pub fn set_viewport_non_geo(&mut self, viewport: ViewportNonGeo) {
@@ -614,6 +772,7 @@ impl Screen<'_> {
 
 		let bounds = aerodrome.config().views[view].bounds;
 		self.transform = Transform::new_view(viewport, bounds);
+		self.size = viewport.size;
 	}
 
 	pub fn click_regions(&self) -> &[RECT] {
@@ -624,11 +783,24 @@ impl Screen<'_> {
 		&mut self,
 		point: POINT,
 		click: ClickType,
+	) -> Option<String> {
+		let instant_start = Instant::now();
+
+		let scratchpad = self.process_click(point, click);
+
+		self.stats.click.record(instant_start.elapsed());
+		scratchpad
+	}
+
+	fn process_click(
+		&mut self,
+		point: POINT,
+		click: ClickType,
 	) -> Option<String> {
 		let target = self
 			.targets
 			.as_ref()
-			.map(|targets| *targets.sample(point.x as usize, point.y as usize))
+			.map(|targets| targets.sample(point.x as usize, point.y as usize))
 			.unwrap_or(Target::None);
 
 		let selection = self.selected.take();
@@ -683,6 +855,19 @@ impl Screen<'_> {
 		}
 	}
 
+	pub fn frame_stats(&self) -> FrameStats {
+		FrameStats {
+			background: self.stats.background.timing(),
+			foreground: self.stats.foreground.timing(),
+			targets: self.stats.targets.timing(),
+			click: self.stats.click.timing(),
+			tick: self.context.tick_time().timing(),
+			background_calls: self.stats.background_calls,
+			foreground_calls: self.stats.foreground_calls,
+			foreground_points: self.stats.foreground_points,
+		}
+	}
+
 	#[must_use]
 	pub fn is_background_refresh_required(&mut self) -> bool {
 		let controlling = self.is_controlling();
@@ -710,7 +895,56 @@ impl Drop for Screen<'_> {
 	}
 }
 
-#[derive(Debug, Default)]
+// merges regions into the region directly above them if they span the same
+// columns. regions must be ordered by row.
+fn merge_regions(regions: &mut Vec<RECT>) {
+	let mut columns = HashMap::<_, usize>::new();
+	let mut merged: Vec<RECT> = Vec::with_capacity(regions.len());
+
+	for rect in regions.drain(..) {
+		match columns.get(&(rect.left, rect.right)) {
+			Some(&i) if merged[i].bottom == rect.top => {
+				merged[i].bottom = rect.bottom
+			},
+			_ => {
+				columns.insert((rect.left, rect.right), merged.len());
+				merged.push(rect);
+			},
+		}
+	}
+
+	*regions = merged;
+}
+
+#[derive(Default)]
+struct Stats {
+	background: Histogram,
+	foreground: Histogram,
+	targets: Histogram,
+	click: Histogram,
+	background_calls: u32,
+	foreground_calls: u32,
+	foreground_points: u32,
+}
+
+#[derive(Clone, Copy, PartialEq)]
+struct TargetsKey {
+	instance: u64,
+	revision: u64,
+	controlling: bool,
+	transform: Transform,
+	size: [f64; 2],
+}
+
+#[derive(Clone, Copy, PartialEq)]
+struct ForegroundKey {
+	revision: Option<u64>,
+	transform: Transform,
+	size: [f64; 2],
+	selected: Option<usize>,
+}
+
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
 struct Transform(f64, f64, f64, f64, f64, f64);
 
 impl Transform {
@@ -760,6 +994,40 @@ impl Transform {
 		)
 	}
 
+	// the source space box covering the screen, widened by a margin for
+	// screen space offsets and stroke widths. none if the size is unknown.
+	fn visible(&self, size: [f64; 2]) -> Option<SourceBox> {
+		const MARGIN: f64 = 64.0;
+
+		let det = self.0 * self.4 - self.1 * self.3;
+		if !(size[0] > 0.0 && size[1] > 0.0) || det == 0.0 {
+			return None
+		}
+
+		let corners = [
+			(-MARGIN, -MARGIN),
+			(size[0] + MARGIN, -MARGIN),
+			(-MARGIN, size[1] + MARGIN),
+			(size[0] + MARGIN, size[1] + MARGIN),
+		];
+
+		let mut visible = SourceBox::EMPTY;
+		for (x, y) in corners {
+			let (x, y) = (x - self.2, y - self.5);
+			visible.extend((
+				(self.4 * x - self.1 * y) / det,
+				(self.0 * y - self.3 * x) / det,
+			));
+		}
+
+		Some(visible)
+	}
+
+	// the largest distance on screen covered by one source unit
+	fn scale(&self) -> f64 {
+		self.0.hypot(self.3).max(self.1.hypot(self.4))
+	}
+
 	fn transform(&self, (x, y): (f64, f64)) -> (f64, f64) {
 		(
 			x * self.0 + y * self.1 + self.2,
@@ -783,75 +1051,575 @@ impl Transform {
 
 trait Transformable {
 	fn transform(&self, transform: &Transform) -> (f64, f64);
+	fn source(&self) -> SourcePoint;
 }
 
 impl Transformable for Point {
 	fn transform(&self, transform: &Transform) -> (f64, f64) {
 		transform.transform_point(self)
 	}
+
+	fn source(&self) -> SourcePoint {
+		SourcePoint {
+			x: self.x as f64,
+			y: self.y as f64,
+			dx: 0.0,
+			dy: 0.0,
+		}
+	}
 }
 
 impl Transformable for GeoPoint {
 	fn transform(&self, transform: &Transform) -> (f64, f64) {
 		transform.transform_geo_point(self)
 	}
+
+	fn source(&self) -> SourcePoint {
+		SourcePoint {
+			x: self.geo.lat as f64,
+			y: self.geo.lon as f64,
+			dx: self.offset.x as f64,
+			dy: self.offset.y as f64,
+		}
+	}
+}
+
+// a point before projection, offset by (dx, dy) in screen space afterwards
+#[derive(Clone, Copy)]
+struct SourcePoint {
+	x: f64,
+	y: f64,
+	dx: f64,
+	dy: f64,
+}
+
+// an axis-aligned box in source space
+#[derive(Clone, Copy)]
+struct SourceBox {
+	min: (f64, f64),
+	max: (f64, f64),
+}
+
+impl SourceBox {
+	const EMPTY: Self = Self {
+		min: (f64::INFINITY, f64::INFINITY),
+		max: (f64::NEG_INFINITY, f64::NEG_INFINITY),
+	};
+
+	fn new<T: Transformable>((min, max): &(T, T)) -> Self {
+		let (min, max) = (min.source(), max.source());
+		Self {
+			min: (min.x, min.y),
+			max: (max.x, max.y),
+		}
+	}
+
+	fn extend(&mut self, (x, y): (f64, f64)) {
+		self.min = (self.min.0.min(x), self.min.1.min(y));
+		self.max = (self.max.0.max(x), self.max.1.max(y));
+	}
+
+	fn intersects(&self, other: &Self) -> bool {
+		self.min.0 <= other.max.0
+			&& other.min.0 <= self.max.0
+			&& self.min.1 <= other.max.1
+			&& other.min.1 <= self.max.1
+	}
+}
+
+struct ScenePath {
+	style: usize,
+	points: Range<usize>,
+	bounds: SourceBox,
+}
+
+struct NodePaths {
+	off: Range<usize>,
+	on: Range<usize>,
+	selected: Range<usize>,
+}
+
+struct EdgePaths {
+	off: Range<usize>,
+	on: Range<usize>,
+}
+
+// every drawable path of an aerodrome or view flattened into one table, with
+// the styles to draw them. shared by all screens showing the same aerodrome
+// instance and view through the context's SceneCache.
+pub struct SceneData {
+	instance: u64,
+	view: Option<usize>,
+	styles: Vec<Style>,
+	source: Vec<SourcePoint>,
+	levels: Vec<u8>,
+	paths: Vec<ScenePath>,
+	base: Range<usize>,
+	nodes: Vec<NodePaths>,
+	edges: Vec<EdgePaths>,
+}
+
+// a screen's projection of shared scene data. points only need to be
+// projected again when the transform or size changes, and only those of
+// visible paths at the level of detail the scale calls for are kept, with
+// each path's range into them.
+struct Scene {
+	data: Rc<SceneData>,
+	transform: Option<Transform>,
+	size: [f64; 2],
+	points: Vec<POINT>,
+	ranges: Vec<Range<usize>>,
 }
 
 #[derive(Default)]
-struct Lookup2d<T> {
-	data: Vec<T>,
-	width: usize,
+pub struct SceneCache {
+	scenes: HashMap<(u64, Option<usize>), Weak<SceneData>>,
 }
 
-impl<T: Copy> Lookup2d<T> {
-	fn new(item: T, width: usize, height: usize) -> Self {
+impl SceneCache {
+	pub fn load(
+		&mut self,
+		aerodrome: &Aerodrome,
+		view: Option<usize>,
+	) -> Rc<SceneData> {
+		self.scenes.retain(|_, scene| scene.strong_count() > 0);
+
+		let key = (aerodrome.instance(), view);
+		if let Some(scene) = self.scenes.get(&key).and_then(Weak::upgrade) {
+			return scene
+		}
+
+		let scene = Rc::new(SceneData::new(aerodrome, view));
+		self.scenes.insert(key, Rc::downgrade(&scene));
+		scene
+	}
+}
+
+// paths collected for drawing, in order. each run of adjacent paths with the
+// same style selects it once, and a run of lines goes out in a single
+// PolyPolyline. filled paths are still drawn one by one, since merging them
+// into a PolyPolygon changes how overlapping shapes fill.
+#[derive(Default)]
+struct Batch {
+	paths: Vec<usize>,
+	points: Vec<POINT>,
+	polylines: Vec<u32>,
+	calls: u32,
+	points_drawn: u32,
+}
+
+impl Batch {
+	fn add(&mut self, paths: Range<usize>) {
+		self.paths.extend(paths);
+	}
+
+	unsafe fn draw(&mut self, hdc: HDC, scene: &Scene) {
+		let styles = &scene.data.styles;
+		let paths = &scene.data.paths;
+
+		let ranges = &scene.ranges;
+
+		self
+			.paths
+			.retain(|&i| paths[i].style < styles.len() && ranges[i].len() >= 2);
+
+		let same_style = |&a: &usize, &b: &usize| paths[a].style == paths[b].style;
+
+		for run in self.paths.chunk_by(same_style) {
+			let style = &styles[paths[run[0]].style];
+			style.apply(hdc);
+
+			for &i in run {
+				let points = &scene.points[ranges[i].clone()];
+
+				if style.filled {
+					let _ = Gdi::Polygon(hdc, points);
+					self.calls += 1;
+				} else {
+					self.polylines.push(points.len() as u32);
+					self.points.extend_from_slice(points);
+				}
+
+				self.points_drawn += points.len() as u32;
+			}
+
+			if !self.polylines.is_empty() {
+				let _ = Gdi::PolyPolyline(hdc, self.points.as_ptr(), &self.polylines);
+				self.calls += 1;
+
+				self.points.clear();
+				self.polylines.clear();
+			}
+		}
+
+		self.paths.clear();
+	}
+}
+
+impl SceneData {
+	fn new(aerodrome: &Aerodrome, view: Option<usize>) -> Self {
+		let config = aerodrome.config();
+
+		let mut this = Self {
+			instance: aerodrome.instance(),
+			view,
+			styles: (config.styles.iter())
+				.map(|style| unsafe { Style::new(style) })
+				.collect(),
+			source: Vec::new(),
+			levels: Vec::new(),
+			paths: Vec::new(),
+			base: 0..0,
+			nodes: Vec::new(),
+			edges: Vec::new(),
+		};
+
+		if let Some(view) = view {
+			let Some(view) = config.views.get(view) else {
+				return this
+			};
+			let map = &config.maps[view.map];
+
+			this.base = this.add_paths(&map.base);
+			this.add_items(map.nodes.iter(), map.edges.iter());
+		} else {
+			this.add_items(
+				config.nodes.iter().map(|node| &node.display),
+				config.edges.iter().map(|edge| &edge.display),
+			);
+		}
+
+		this
+	}
+
+	fn add_items<'a, T: Clone + Debug + Transformable + 'a>(
+		&mut self,
+		nodes: impl Iterator<Item = &'a NodeDisplay<T>>,
+		edges: impl Iterator<Item = &'a EdgeDisplay<T>>,
+	) {
+		for node in nodes {
+			let paths = NodePaths {
+				off: self.add_paths(&node.off),
+				on: self.add_paths(&node.on),
+				selected: self.add_paths(&node.selected),
+			};
+			self.nodes.push(paths);
+		}
+
+		for edge in edges {
+			let paths = EdgePaths {
+				off: self.add_paths(&edge.off),
+				on: self.add_paths(&edge.on),
+			};
+			self.edges.push(paths);
+		}
+	}
+
+	fn add_paths<T: Clone + Debug + Transformable>(
+		&mut self,
+		paths: &[Path<T>],
+	) -> Range<usize> {
+		let start = self.paths.len();
+
+		for path in paths {
+			let points = self.source.len();
+			self.source.extend(path.points.iter().map(|p| p.source()));
+			if path.levels.len() == path.points.len() {
+				self.levels.extend_from_slice(&path.levels);
+			} else {
+				self.levels.resize(self.source.len(), u8::MAX);
+			}
+			self.paths.push(ScenePath {
+				style: path.style,
+				points: points..self.source.len(),
+				bounds: SourceBox::new(&path.bounds),
+			});
+		}
+
+		start..self.paths.len()
+	}
+}
+
+impl Scene {
+	fn new(data: Rc<SceneData>) -> Self {
 		Self {
-			data: vec![item; width * height],
-			width,
+			data,
+			transform: None,
+			size: [0.0; 2],
+			points: Vec::new(),
+			ranges: Vec::new(),
+		}
+	}
+
+	// the largest simplification error allowed on screen, in pixels
+	const LOD_ERROR: f64 = 0.5;
+
+	fn project(&mut self, transform: Transform, size: [f64; 2]) {
+		if self.transform == Some(transform) && self.size == size {
+			return
+		}
+
+		let visible = transform.visible(size);
+		let scale = transform.scale();
+		let level = (LOD_TOLERANCES.iter())
+			.rposition(|&t| t as f64 * scale <= Self::LOD_ERROR)
+			.unwrap_or(0) as u8;
+
+		let data = &self.data;
+		self.points.clear();
+		self.ranges.clear();
+
+		for path in &data.paths {
+			let start = self.points.len();
+
+			if visible.is_some_and(|v| !v.intersects(&path.bounds)) {
+				self.ranges.push(start..start);
+				continue
+			}
+
+			for i in path.points.clone() {
+				if data.levels[i] < level {
+					continue
+				}
+
+				let p = &data.source[i];
+				let (x, y) = transform.transform((p.x, p.y));
+				self.points.push(POINT {
+					x: (x + p.dx).round() as i32,
+					y: (y + p.dy).round() as i32,
+				});
+			}
+
+			self.ranges.push(start..self.points.len());
 		}
+
+		self.transform = Some(transform);
+		self.size = size;
 	}
+}
+
+// hit-testing for click targets. projected polygons are bucketed by their
+// bounding boxes into a coarse grid, and only the polygons overlapping the
+// sampled cell are tested exactly. screen-space points are stored as f32 and
+// each target's points run up to the next target's start.
+#[derive(Default)]
+struct TargetIndex {
+	targets: Vec<(Target, u32)>,
+	points: Vec<(f32, f32)>,
+	cells: Vec<Vec<u32>>,
+	columns: usize,
+	rows: usize,
+	width: usize,
+	height: usize,
+}
+
+impl TargetIndex {
+	const CELL_SIZE: usize = 64;
+
+	fn reset(&mut self, width: usize, height: usize) {
+		self.clear();
 
-	fn sample(&self, x: usize, y: usize) -> &T {
-		&self.data[(x + y * self.width).min(self.data.len() - 1)]
+		self.width = width;
+		self.height = height;
+		self.columns = width.div_ceil(Self::CELL_SIZE);
+		self.rows = height.div_ceil(Self::CELL_SIZE);
+		self.cells.resize_with(self.columns * self.rows, Vec::new);
 	}
 
-	fn clear(&mut self, item: T) {
-		self.data.fill(item);
+	fn clear(&mut self) {
+		self.targets.clear();
+		self.points.clear();
+		self.cells.iter_mut().for_each(|cell| cell.clear());
+	}
+
+	fn points(&self, id: usize) -> &[(f32, f32)] {
+		let start = self.targets[id].1 as usize;
+		let end = (self.targets.get(id + 1))
+			.map(|(_, end)| *end as usize)
+			.unwrap_or(self.points.len());
+
+		&self.points[start..end]
+	}
+
+	fn add(&mut self, target: Target, points: impl Iterator<Item = (f64, f64)>) {
+		let start = self.points.len();
+		self
+			.points
+			.extend(points.map(|(x, y)| (x as f32, y as f32)));
+		let points = &self.points[start..];
+
+		let (min, max) = points.iter().fold(
+			((f32::MAX, f32::MAX), (f32::MIN, f32::MIN)),
+			|(min, max), &(x, y)| {
+				((min.0.min(x), min.1.min(y)), (max.0.max(x), max.1.max(y)))
+			},
+		);
+
+		if points.len() < 3
+			|| self.columns == 0
+			|| self.rows == 0
+			|| max.0 < 0.0
+			|| max.1 < 0.0
+			|| min.0 >= self.width as f32
+			|| min.1 >= self.height as f32
+		{
+			self.points.truncate(start);
+			return
+		}
+
+		let cell =
+			|v: f32, n: usize| ((v.max(0.0) as usize) / Self::CELL_SIZE).min(n - 1);
+
+		let id = self.targets.len() as u32;
+		self.targets.push((target, start as u32));
+
+		for row in cell(min.1, self.rows)..=cell(max.1, self.rows) {
+			for column in cell(min.0, self.columns)..=cell(max.0, self.columns) {
+				self.cells[row * self.columns + column].push(id);
+			}
+		}
 	}
 
-	fn add_poly(&mut self, item: T, points: &[(f64, f64)]) {
-		let (min, max) = points
+	fn sample(&self, x: usize, y: usize) -> Target {
+		if x >= self.width || y >= self.height {
+			return Target::None
+		}
+
+		let cell =
+			&self.cells[(y / Self::CELL_SIZE) * self.columns + x / Self::CELL_SIZE];
+		let (x, y) = (x as f32 + 0.5, y as f32 + 0.5);
+
+		// later targets take priority, as nodes are added after blocks
+		cell
 			.iter()
-			.map(|(_, y)| y.max(0.0).round() as usize)
-			.fold((usize::MAX, 0), |(min, max), y| (min.min(y), max.max(y)));
-		let max_y = self.data.len() / self.width - 1;
+			.rev()
+			.map(|&id| id as usize)
+			.find(|&id| contains(self.points(id), x, y))
+			.map(|id| self.targets[id].0)
+			.unwrap_or(Target::None)
+	}
+
+	// number of pixels covered by any target within each whole cell of a grid
+	// with the given cell size, in row-major order. computed from scanline
+	// spans without rasterising. rows of cells are independent, so large
+	// indices are split into horizontal bands computed on the worker pool.
+	fn coverage(&self, size: usize) -> Vec<usize> {
+		const MIN_TARGETS: usize = 256;
+
+		let columns = self.width / size;
+		let rows = self.height / size;
+
+		let mut coverage = vec![0; columns * rows];
+		if coverage.is_empty() {
+			return coverage
+		}
+
+		let threads = if self.targets.len() < MIN_TARGETS {
+			1
+		} else {
+			pool::threads().min(rows)
+		};
+
+		if threads == 1 {
+			self.band_coverage(size, columns, 0..rows, &mut coverage);
+			return coverage
+		}
+
+		let band = rows.div_ceil(threads);
+		let tasks = (coverage.chunks_mut(band * columns).enumerate())
+			.map(|(i, chunk)| {
+				let band = i * band..((i + 1) * band).min(rows);
+				Box::new(move || self.band_coverage(size, columns, band, chunk)) as _
+			})
+			.collect();
+		pool::run(tasks);
+
+		coverage
+	}
 
-		let min = min.min(max_y);
-		let max = max.min(max_y);
+	// coverage for a range of cell rows, written to the matching slice
+	fn band_coverage(
+		&self,
+		size: usize,
+		columns: usize,
+		rows: Range<usize>,
+		coverage: &mut [usize],
+	) {
+		let max_x = (columns * size - 1) as f32;
+		let min_y = rows.start * size;
+		let max_y = rows.end * size - 1;
 
+		let mut spans = Vec::new();
 		let mut intersections = Vec::new();
-		for y in min..=max {
-			let yf = y as f64 + 0.5;
 
-			for i in 0..points.len() {
-				let (x1, y1) = points[i];
-				let (x2, y2) = points[(i + 1) % points.len()];
+		for id in 0..self.targets.len() {
+			let points = self.points(id);
+
+			let (min, max) = points
+				.iter()
+				.map(|(_, y)| y.max(0.0).round() as usize)
+				.fold((usize::MAX, 0), |(min, max), y| (min.min(y), max.max(y)));
+
+			for y in min.max(min_y)..=max.min(max_y) {
+				let yf = y as f32 + 0.5;
 
-				if (y1 > yf) != (y2 > yf) {
-					intersections.push(x1 + (x2 - x1) * (yf - y1) / (y2 - y1));
+				for i in 0..points.len() {
+					let (x1, y1) = points[i];
+					let (x2, y2) = points[(i + 1) % points.len()];
+
+					if (y1 > yf) != (y2 > yf) {
+						intersections.push(x1 + (x2 - x1) * (yf - y1) / (y2 - y1));
+					}
 				}
+
+				intersections.sort_by(|a, b| a.partial_cmp(b).unwrap());
+
+				for pair in intersections.chunks_exact(2) {
+					let x1 = (pair[0] - 0.5).round();
+					let x2 = (pair[1] - 0.5).round();
+
+					if x2 >= 0.0 && x1 <= max_x {
+						spans.push((y, x1.max(0.0) as usize, x2.min(max_x) as usize));
+					}
+				}
+
+				intersections.clear();
 			}
+		}
 
-			intersections.sort_by(|a, b| a.partial_cmp(b).unwrap());
+		spans.sort_unstable();
 
-			for pair in intersections.chunks_exact(2) {
-				let x1 = ((pair[0] - 0.5).round() as usize).min(self.width - 1);
-				let x2 = ((pair[1] - 0.5).round() as usize).min(self.width - 1);
+		// merge overlapping spans on each row so that pixels covered by several
+		// targets are only counted once
+		let mut spans = spans.into_iter().peekable();
+		while let Some((y, x1, mut x2)) = spans.next() {
+			while let Some((_, _, next)) =
+				spans.next_if(|&(ny, nx1, _)| ny == y && nx1 <= x2 + 1)
+			{
+				x2 = x2.max(next);
+			}
 
-				self.data[y * self.width..][..self.width][x1..=x2].fill(item);
+			let row = &mut coverage[(y / size - rows.start) * columns..][..columns];
+			for column in x1 / size..=x2 / size {
+				let start = x1.max(column * size);
+				let end = x2.min(column * size + size - 1);
+				row[column] += end + 1 - start;
 			}
+		}
+	}
+}
+
+fn contains(points: &[(f32, f32)], x: f32, y: f32) -> bool {
+	let mut inside = false;
 
-			intersections.clear();
+	for i in 0..points.len() {
+		let (x1, y1) = points[i];
+		let (x2, y2) = points[(i + 1) % points.len()];
+
+		if (y1 > y) != (y2 > y) && x < x1 + (x2 - x1) * (y - y1) / (y2 - y1) {
+			inside = !inside;
 		}
 	}
+
+	inside
 }
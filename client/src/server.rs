@@ -1,21 +1,25 @@
 use crate::config::{ConfigManager, ConfigMapping};
-use crate::ipc::{Channel, Downstream, ServerChannel, Upstream};
+use crate::ipc::{
+	Channel, Downstream, Patch, PendingPatch, Scenery, ServerChannel, Shared,
+	Upstream,
+};
 
-use std::collections::{HashMap, HashSet};
+use std::collections::HashMap;
 use std::net::Ipv4Addr;
-use std::sync::Arc;
+use std::sync::{Arc, Mutex as StdMutex};
 use std::thread::{Builder as ThreadBuilder, JoinHandle};
-use std::time::{Duration, Instant};
+use std::time::Duration;
 
-use bars_config::Aerodrome;
+use bars_config::{Aerodrome, BlockState};
 use bars_protocol::{
-	Downstream as NetDownstream, Patch, State, Upstream as NetUpstream,
+	BlockState as NetBlockState, Downstream as NetDownstream, Patch as NetPatch,
+	State, Upstream as NetUpstream,
 };
 
 use anyhow::Result;
 
 use futures::sink::SinkExt;
-use futures::stream::StreamExt;
+use futures::stream::{SplitSink, StreamExt};
 
 use tokio::net::{TcpListener, TcpStream};
 use tokio::runtime::Builder as RuntimeBuilder;
@@ -23,6 +27,7 @@ use tokio::sync::broadcast::Sender;
 use tokio::sync::mpsc::{UnboundedReceiver, UnboundedSender};
 use tokio::sync::oneshot::error::TryRecvError;
 use tokio::sync::{mpsc, oneshot, Mutex};
+use tokio::time::{Instant, MissedTickBehavior};
 
 use tokio_tungstenite::tungstenite::http::Uri;
 use tokio_tungstenite::tungstenite::Message;
@@ -30,8 +35,11 @@ use tokio_tungstenite::{MaybeTlsStream, WebSocketStream};
 
 use tracing::{debug, error, trace, warn};
 
-const SOCKET_POLL_TIMEOUT: Duration = Duration::from_millis(100);
+type SocketSink =
+	SplitSink<WebSocketStream<MaybeTlsStream<TcpStream>>, Message>;
+
 const STATE_POLL_INTERVAL: Duration = Duration::from_secs(30);
+const PATCH_WINDOW: Duration = Duration::from_millis(50);
 
 pub struct ConnectOptions {
 	pub server: String,
@@ -109,9 +117,28 @@ impl Server {
 	}
 }
 
+// what the aerodrome managers send to every subscriber
+#[derive(Clone)]
+enum Broadcast {
+	// a change, for subscribers already in sync with the aerodrome
+	Delta(Shared),
+	// the complete state of an aerodrome, starting with its config. only sent
+	// on to subscribers yet to sync, as the rest have seen every delta since.
+	Snapshot(Arc<[Shared]>),
+}
+
+impl Broadcast {
+	fn icao(&self) -> &String {
+		match self {
+			Self::Delta(message) => message.message().icao(),
+			Self::Snapshot(messages) => messages[0].message().icao(),
+		}
+	}
+}
+
 #[derive(Clone)]
 struct Worker {
-	broadcast: Sender<Downstream>,
+	broadcast: Sender<Broadcast>,
 }
 
 impl Worker {
@@ -146,7 +173,10 @@ impl Worker {
 		mut rx: UnboundedReceiver<Upstream>,
 	) -> Result<()> {
 		let mut aerodromes = HashMap::new();
-		let config = Arc::new(Mutex::new(ConfigManager::new(mapping)));
+		// shared so every aerodrome reuses pooled keep-alive connections
+		let http = reqwest::Client::new();
+		let config =
+			Arc::new(Mutex::new(ConfigManager::new(mapping, http.clone())));
 
 		while let Some(message) = rx.recv().await {
 			let Some(icao) = message.icao() else {
@@ -160,6 +190,7 @@ impl Worker {
 					&connect,
 					config.clone(),
 					self.broadcast.clone(),
+					http.clone(),
 				)
 				.await?;
 				aerodromes.insert(icao.clone(), aerodrome);
@@ -211,6 +242,10 @@ impl Worker {
 				if let Ok((stream, remote)) = listener.accept().await {
 					debug!("accepted {remote}");
 
+					if let Err(err) = stream.set_nodelay(true) {
+						debug!("{err}");
+					}
+
 					let channel = ServerChannel::Tcp(stream);
 					if let Err(err) =
 						state.handle_stream(channel, server_tx.clone()).await
@@ -232,36 +267,60 @@ impl Worker {
 		let (mut stream_rx, mut stream_tx) = stream.into_split();
 		let mut ipc_rx = self.broadcast.subscribe();
 
-		let tracked = Arc::new(Mutex::new(HashSet::new()));
+		// tracked aerodromes, and whether this client has had their snapshot
+		let tracked = Arc::new(Mutex::new(HashMap::<String, bool>::new()));
 
 		{
 			let tracked = tracked.clone();
 			let server_tx = server_tx.clone();
 
 			tokio::spawn(async move {
-				while let Ok(message) = ipc_rx.recv().await {
+				'recv: while let Ok(broadcast) = ipc_rx.recv().await {
 					let mut tracked = tracked.lock().await;
 
-					if !tracked.contains(message.icao()) {
+					let Some(synced) = tracked.get_mut(broadcast.icao()) else {
 						continue
-					}
+					};
+
+					let messages = match &broadcast {
+						Broadcast::Delta(message) => {
+							// state changes before the snapshot are already part of it
+							if !*synced
+								&& matches!(
+									message.message(),
+									Downstream::Patch { .. } | Downstream::Control { .. }
+								) {
+								continue
+							}
 
-					if let Downstream::Error {
-						icao,
-						disconnect: true,
-						..
-					} = &message
-					{
-						debug_assert!(tracked.remove(icao));
-						let _ = server_tx.send(Upstream::Track {
-							icao: icao.clone(),
-							track: false,
-						});
-					}
+							std::slice::from_ref(message)
+						},
+						Broadcast::Snapshot(_) if *synced => continue,
+						Broadcast::Snapshot(messages) => {
+							*synced = true;
+							&messages[..]
+						},
+					};
+
+					for message in messages {
+						if let Downstream::Error {
+							icao,
+							disconnect: true,
+							..
+						} = message.message()
+						{
+							let removed = tracked.remove(icao).is_some();
+							debug_assert!(removed);
+							let _ = server_tx.send(Upstream::Track {
+								icao: icao.clone(),
+								track: false,
+							});
+						}
 
-					if let Err(err) = stream_tx.send(message).await {
-						debug!("{err}");
-						break
+						if let Err(err) = stream_tx.send_shared(message).await {
+							debug!("{err}");
+							break 'recv
+						}
 					}
 				}
 
@@ -276,7 +335,7 @@ impl Worker {
 					Err(_) => {
 						let mut tracked = tracked.lock().await;
 
-						for icao in tracked.drain() {
+						for (icao, _) in tracked.drain() {
 							let _ = server_tx.send(Upstream::Track { icao, track: false });
 						}
 
@@ -290,11 +349,13 @@ impl Worker {
 						let mut tracked = tracked.lock().await;
 
 						if *track {
-							if !tracked.insert(icao.clone()) {
+							if tracked.contains_key(icao) {
 								continue
 							}
+
+							tracked.insert(icao.clone(), false);
 						} else {
-							if !tracked.remove(icao) {
+							if tracked.remove(icao).is_none() {
 								continue
 							}
 						}
@@ -315,15 +376,26 @@ struct AerodromeManager {
 	data: Arc<Mutex<AerodromeManagerData>>,
 	server: Option<(String, String)>,
 	icao: String,
-	broadcast: Sender<Downstream>,
+	broadcast: Sender<Broadcast>,
+	// patches held back to be merged and broadcast together
+	pending: Arc<StdMutex<HeldPatch>>,
+	http: reqwest::Client,
+}
+
+#[derive(Default)]
+struct HeldPatch {
+	patch: PendingPatch,
+	// counts flushes, so that a window's timer only ever sends that window
+	window: u64,
 }
 
 struct AerodromeManagerData {
-	config: Option<Aerodrome>,
+	config: Option<(Aerodrome, Ids)>,
 	controlling: bool,
 	trackers: usize,
-	state: Patch,
-	socket: Option<Arc<Mutex<WebSocketStream<MaybeTlsStream<TcpStream>>>>>,
+	state: NetPatch,
+	socket: Option<Arc<Mutex<SocketSink>>>,
+	stop: Option<oneshot::Sender<()>>,
 }
 
 impl AerodromeManager {
@@ -331,15 +403,17 @@ impl AerodromeManager {
 		icao: &str,
 		options: &Option<ConnectOptions>,
 		config: Arc<Mutex<ConfigManager>>,
-		broadcast: Sender<Downstream>,
+		broadcast: Sender<Broadcast>,
+		http: reqwest::Client,
 	) -> Result<Self> {
 		let this = Self {
 			data: Arc::new(Mutex::new(AerodromeManagerData {
 				config: None,
 				controlling: false,
 				trackers: 0,
-				state: Patch::default(),
+				state: NetPatch::default(),
 				socket: None,
+				stop: None,
 			})),
 			server: options.as_ref().map(|options| {
 				let secure = options
@@ -365,6 +439,8 @@ impl AerodromeManager {
 			}),
 			icao: icao.into(),
 			broadcast: broadcast.clone(),
+			pending: Arc::default(),
+			http,
 		};
 
 		{
@@ -375,7 +451,8 @@ impl AerodromeManager {
 					Ok(None) => (),
 					Ok(Some(config)) => {
 						{
-							this.data.lock().await.config = Some(config);
+							let ids = Ids::new(&config);
+							this.data.lock().await.config = Some((config, ids));
 						}
 						this.sync_clients().await;
 					},
@@ -387,26 +464,82 @@ impl AerodromeManager {
 		Ok(this)
 	}
 
+	// sends a message straight away, after any held patch to keep the order
 	fn broadcast(&self, message: Downstream) {
-		if self.broadcast.send(message).is_err() {
+		let mut held = self.pending.lock().unwrap();
+		self.flush(&mut held);
+		self.publish(Broadcast::Delta(Shared::new(message)));
+	}
+
+	// patches from the network are held for a short window and merged, so that
+	// a burst of updates reaches each subscriber as one message
+	fn broadcast_patch(&self, patch: Patch) {
+		let mut held = self.pending.lock().unwrap();
+
+		// a profile is applied before the nodes and blocks of the same patch, so
+		// earlier entries would land on top of it if merged
+		if patch.profile.is_some() {
+			self.flush(&mut held);
+		}
+
+		// the first patch of a window starts the timer that sends it
+		let idle = held.patch.is_empty();
+		held.patch.merge(patch);
+		if !idle || held.patch.is_empty() {
+			return
+		}
+
+		let window = held.window;
+		let this = self.clone();
+		tokio::spawn(async move {
+			tokio::time::sleep(PATCH_WINDOW).await;
+
+			// the window may already have been flushed by another message
+			let mut held = this.pending.lock().unwrap();
+			if held.window == window {
+				this.flush(&mut held);
+			}
+		});
+	}
+
+	fn flush(&self, held: &mut HeldPatch) {
+		if !held.patch.is_empty() {
+			held.window += 1;
+			self.publish(Broadcast::Delta(Shared::new(Downstream::Patch {
+				icao: self.icao.clone(),
+				patch: held.patch.take(),
+			})));
+		}
+	}
+
+	fn publish(&self, broadcast: Broadcast) {
+		if self.broadcast.send(broadcast).is_err() {
 			warn!("broadcast channel full");
 		}
 	}
 
 	async fn sync_clients(&self) {
 		let data = self.data.lock().await;
-		if let Some(config) = &data.config {
-			self.broadcast(Downstream::Config {
-				data: config.clone(),
-			});
-			self.broadcast(Downstream::Control {
-				icao: self.icao.clone(),
-				control: data.controlling,
-			});
-			self.broadcast(Downstream::Patch {
-				icao: self.icao.clone(),
-				patch: data.state.clone(),
-			});
+		if let Some((config, ids)) = &data.config {
+			let snapshot = [
+				Downstream::Config {
+					data: config.clone(),
+				},
+				Downstream::Control {
+					icao: self.icao.clone(),
+					control: data.controlling,
+				},
+				Downstream::Patch {
+					icao: self.icao.clone(),
+					patch: ids.from_net(&data.state),
+				},
+			];
+
+			let mut held = self.pending.lock().unwrap();
+			self.flush(&mut held);
+			self.publish(Broadcast::Snapshot(
+				snapshot.into_iter().map(Shared::new).collect(),
+			));
 		}
 	}
 
@@ -429,26 +562,42 @@ impl AerodromeManager {
 			);
 
 			let socket = tokio_tungstenite::connect_async(connect_endpoint).await?.0;
+			let (socket, mut stream) = socket.split();
 			let socket = Arc::new(Mutex::new(socket));
+			let (stop, mut stopped) = oneshot::channel();
 			data.socket = Some(socket.clone());
+			data.stop = Some(stop);
 
-			let socket = socket.clone();
 			let this = self.clone();
 			tokio::spawn(async move {
 				use std::sync::atomic::{AtomicUsize, Ordering};
 				static COUNTER: AtomicUsize = AtomicUsize::new(0);
 
-				let mut last_state_poll = Instant::now();
-
 				let n = COUNTER.fetch_add(1, Ordering::SeqCst);
 
+				let mut state_poll = tokio::time::interval_at(
+					Instant::now() + STATE_POLL_INTERVAL,
+					STATE_POLL_INTERVAL,
+				);
+				state_poll.set_missed_tick_behavior(MissedTickBehavior::Delay);
+
 				loop {
 					let socket_arc = &socket;
 
-					let mut socket = socket.lock().await;
-					match tokio::time::timeout(SOCKET_POLL_TIMEOUT, socket.next()).await {
-						Ok(Some(Ok(Message::Text(message)))) => {
-							type Message = NetDownstream<Option<Patch>>;
+					// the read half is owned by this task, so senders only contend
+					// for the write half and never wait on a pending read
+					let message = tokio::select! {
+						message = stream.next() => message,
+						_ = state_poll.tick() => {
+							this.poll_state(&state_endpoint).await;
+							continue
+						},
+						_ = &mut stopped => break,
+					};
+
+					match message {
+						Some(Ok(Message::Text(message))) => {
+							type Message = NetDownstream<Option<NetPatch>>;
 
 							let Ok(data) = serde_json::from_str::<Message>(message.as_str())
 							else {
@@ -460,6 +609,7 @@ impl AerodromeManager {
 
 							let res = match data {
 								NetDownstream::Heartbeat => {
+									let mut socket = socket.lock().await;
 									Self::send(&mut socket, &NetUpstream::HeartbeatAck).await
 								},
 								NetDownstream::Close => {
@@ -494,11 +644,10 @@ impl AerodromeManager {
 
 									let mut data = this.data.lock().await;
 
-									data.state.apply_patch(patch.clone());
-									this.broadcast(Downstream::Patch {
-										icao: this.icao.clone(),
-										patch,
-									});
+									if let Some((_, ids)) = &data.config {
+										this.broadcast_patch(ids.from_net(&patch));
+									}
+									data.state.apply_patch(patch);
 
 									if let Some(control) = control {
 										data.controlling = control;
@@ -528,8 +677,8 @@ impl AerodromeManager {
 								break
 							}
 						},
-						Ok(Some(Ok(_))) => (),
-						Ok(Some(Err(err))) => {
+						Some(Ok(_)) => (),
+						Some(Err(err)) => {
 							warn!("socket closed with error: {err}");
 							this
 								.disconnect_forced(
@@ -540,7 +689,7 @@ impl AerodromeManager {
 
 							break
 						},
-						Ok(None) => {
+						None => {
 							debug!("socket closed");
 							this
 								.disconnect_forced(
@@ -551,31 +700,6 @@ impl AerodromeManager {
 
 							break
 						},
-						Err(_) => {
-							if last_state_poll.elapsed() > STATE_POLL_INTERVAL {
-								debug!("interval poll state for {}", this.icao);
-
-								last_state_poll = Instant::now();
-
-								let response = match reqwest::get(&state_endpoint).await {
-									Ok(response) => response,
-									Err(err) => {
-										warn!("failed to fetch state: {err}");
-										continue
-									},
-								};
-
-								let Ok(data) = response.json::<State>().await else {
-									warn!("net state deserialisation failed");
-									continue
-								};
-
-								this.broadcast(Downstream::Aircraft {
-									icao: this.icao.clone(),
-									aircraft: data.pilots,
-								});
-							}
-						},
 					}
 				}
 			});
@@ -584,14 +708,45 @@ impl AerodromeManager {
 		Ok(())
 	}
 
+	async fn poll_state(&self, endpoint: &str) {
+		debug!("interval poll state for {}", self.icao);
+
+		let response = match self.http.get(endpoint).send().await {
+			Ok(response) => response,
+			Err(err) => {
+				warn!("failed to fetch state: {err}");
+				return
+			},
+		};
+
+		let Ok(data) = response.json::<State>().await else {
+			warn!("net state deserialisation failed");
+			return
+		};
+
+		self.broadcast(Downstream::Aircraft {
+			icao: self.icao.clone(),
+			aircraft: data.pilots,
+		});
+	}
+
 	async fn disconnect(&self) -> Result<()> {
 		debug!("disconnecting socket");
 
-		if let Some(socket) = &self.data.lock().await.socket.take() {
+		let (socket, stop) = {
+			let mut data = self.data.lock().await;
+			(data.socket.take(), data.stop.take())
+		};
+
+		if let Some(stop) = stop {
+			let _ = stop.send(());
+		}
+
+		if let Some(socket) = socket {
 			let mut socket = socket.lock().await;
 
 			Self::send(&mut socket, &NetUpstream::Close).await?;
-			socket.close(None).await?;
+			socket.close().await?;
 		}
 
 		Ok(())
@@ -599,7 +754,7 @@ impl AerodromeManager {
 
 	async fn disconnect_forced(
 		&self,
-		socket_arc: &Arc<Mutex<WebSocketStream<MaybeTlsStream<TcpStream>>>>,
+		socket_arc: &Arc<Mutex<SocketSink>>,
 		message: String,
 	) {
 		let mut data = self.data.lock().await;
@@ -610,6 +765,7 @@ impl AerodromeManager {
 			.unwrap_or_default()
 		{
 			data.socket = None;
+			data.stop = None;
 			self.broadcast(Downstream::Error {
 				icao: self.icao.clone(),
 				message: Some(message),
@@ -622,10 +778,7 @@ impl AerodromeManager {
 		}
 	}
 
-	async fn send(
-		socket: &mut WebSocketStream<MaybeTlsStream<TcpStream>>,
-		message: &NetUpstream,
-	) -> Result<()> {
+	async fn send(socket: &mut SocketSink, message: &NetUpstream) -> Result<()> {
 		trace!("ws tx: {message:?}");
 
 		if let Ok(data) = serde_json::to_string(message) {
@@ -684,11 +837,19 @@ impl AerodromeManager {
 
 	async fn patch(&self, patch: Patch) -> Result<()> {
 		let mut data = self.data.lock().await;
+		let Some((config, ids)) = &data.config else {
+			warn!("patch received before config loaded");
+			return Ok(())
+		};
+
+		let net = ids.to_net(config, &patch);
 		if let Some(socket) = &data.socket {
 			let mut socket = socket.lock().await;
-			Self::send(&mut socket, &NetUpstream::SharedStateUpdate { patch }).await
+			let message = NetUpstream::SharedStateUpdate { patch: net };
+			Self::send(&mut socket, &message).await
 		} else {
-			data.state.apply_patch(patch.clone());
+			// echoed at once, since only network updates arrive in bursts
+			data.state.apply_patch(net);
 			self.broadcast(Downstream::Patch {
 				icao: self.icao.clone(),
 				patch,
@@ -697,11 +858,19 @@ impl AerodromeManager {
 		}
 	}
 
-	async fn scenery(&self, scenery: HashMap<String, bool>) -> Result<()> {
-		if let Some(socket) = &self.data.lock().await.socket {
+	async fn scenery(&self, scenery: Scenery) -> Result<()> {
+		let data = self.data.lock().await;
+		if let (Some((config, _)), Some(socket)) = (&data.config, &data.socket) {
 			let mut socket = socket.lock().await;
-			for (object_id, state) in scenery {
-				let message = NetUpstream::StateUpdate { object_id, state };
+			for (element, state) in scenery.iter() {
+				let Some(element) = config.elements.get(element) else {
+					continue
+				};
+
+				let message = NetUpstream::StateUpdate {
+					object_id: element.id.clone(),
+					state,
+				};
 				Self::send(&mut socket, &message).await?;
 			}
 		}
@@ -709,3 +878,79 @@ impl AerodromeManager {
 		Ok(())
 	}
 }
+
+// maps network ids to config indices. clients only deal in indices, so
+// patches are translated here at the network edge.
+struct Ids {
+	nodes: HashMap<String, u16>,
+	blocks: HashMap<String, u16>,
+	profiles: HashMap<String, u16>,
+}
+
+impl Ids {
+	fn new(config: &Aerodrome) -> Self {
+		fn index<'a>(
+			ids: impl Iterator<Item = &'a String>,
+		) -> HashMap<String, u16> {
+			ids
+				.enumerate()
+				.map(|(i, id)| (id.clone(), i as u16))
+				.collect()
+		}
+
+		Self {
+			nodes: index(config.nodes.iter().map(|node| &node.id)),
+			blocks: index(config.blocks.iter().map(|block| &block.id)),
+			profiles: index(config.profiles.iter().map(|profile| &profile.id)),
+		}
+	}
+
+	fn from_net(&self, patch: &NetPatch) -> Patch {
+		let block = |(id, state): (&String, &NetBlockState)| {
+			let state = match state {
+				NetBlockState::Clear => BlockState::Clear,
+				NetBlockState::Relax => BlockState::Relax,
+				NetBlockState::Route((a, b)) => BlockState::Route((
+					*self.nodes.get(a)? as usize,
+					*self.nodes.get(b)? as usize,
+				)),
+			};
+
+			Some((*self.blocks.get(id)?, state))
+		};
+
+		Patch {
+			profile: (patch.profile.as_ref())
+				.and_then(|profile| self.profiles.get(profile).copied()),
+			nodes: (patch.nodes.iter())
+				.filter_map(|(id, state)| Some((*self.nodes.get(id)?, *state)))
+				.collect(),
+			blocks: patch.blocks.iter().filter_map(block).collect(),
+		}
+	}
+
+	fn to_net(&self, config: &Aerodrome, patch: &Patch) -> NetPatch {
+		let node = |i: usize| config.nodes.get(i).map(|node| node.id.clone());
+		let block = |(i, state): &(u16, BlockState)| {
+			let state = match state {
+				BlockState::Clear => NetBlockState::Clear,
+				BlockState::Relax => NetBlockState::Relax,
+				BlockState::Route((a, b)) => {
+					NetBlockState::Route((node(*a)?, node(*b)?))
+				},
+			};
+
+			Some((config.blocks.get(*i as usize)?.id.clone(), state))
+		};
+
+		NetPatch {
+			profile: (patch.profile)
+				.and_then(|i| config.profiles.get(i as usize))
+				.map(|profile| profile.id.clone()),
+			nodes: (patch.nodes.iter())
+				.filter_map(|(i, state)| Some((node(*i as usize)?, *state)))
+				.collect(),
+			blocks: patch.blocks.iter().filter_map(block).collect(),
+		}
+	}
+}
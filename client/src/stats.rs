@@ -0,0 +1,82 @@
+use std::fmt;
+use std::time::Duration;
+
+const WINDOW: usize = 256;
+
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct Timing {
+	// microseconds over the most recent samples
+	pub p50: u32,
+	pub p95: u32,
+	pub max: u32,
+	pub samples: u32,
+}
+
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct FrameStats {
+	pub background: Timing,
+	pub foreground: Timing,
+	pub targets: Timing,
+	pub click: Timing,
+	pub tick: Timing,
+
+	// GDI calls and points submitted by the most recent draw
+	pub background_calls: u32,
+	pub foreground_calls: u32,
+	pub foreground_points: u32,
+}
+
+impl fmt::Display for Timing {
+	fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+		write!(
+			f,
+			"p50 {}us, p95 {}us, max {}us ({} samples)",
+			self.p50, self.p95, self.max, self.samples,
+		)
+	}
+}
+
+pub struct Histogram {
+	samples: Box<[u32; WINDOW]>,
+	len: usize,
+	next: usize,
+}
+
+impl Default for Histogram {
+	fn default() -> Self {
+		Self {
+			samples: Box::new([0; WINDOW]),
+			len: 0,
+			next: 0,
+		}
+	}
+}
+
+impl Histogram {
+	pub fn record(&mut self, duration: Duration) {
+		self.samples[self.next] =
+			duration.as_micros().try_into().unwrap_or(u32::MAX);
+		self.next = (self.next + 1) % WINDOW;
+		self.len = (self.len + 1).min(WINDOW);
+	}
+
+	pub fn timing(&self) -> Timing {
+		if self.len == 0 {
+			return Timing::default()
+		}
+
+		let mut samples = self.samples[..self.len].to_vec();
+		samples.sort_unstable();
+
+		let percentile = |p: usize| samples[(self.len - 1) * p / 100];
+
+		Timing {
+			p50: percentile(50),
+			p95: percentile(95),
+			max: samples[self.len - 1],
+			samples: self.len as u32,
+		}
+	}
+}
@@ -0,0 +1,62 @@
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
+use std::time::Instant;
+
+// deadlines keyed by a dense index (node or block). setting or cancelling a
+// key bumps its generation, which invalidates any entry still in the heap
+// for it; those are discarded lazily when they reach the top.
+#[derive(Clone, Default)]
+pub struct Timers {
+	heap: BinaryHeap<Reverse<(Instant, usize, u32)>>,
+	generations: Vec<u32>,
+}
+
+impl Timers {
+	pub fn new() -> Self {
+		Self::default()
+	}
+
+	pub fn set(&mut self, key: usize, deadline: Instant) {
+		let generation = self.bump(key);
+		self.heap.push(Reverse((deadline, key, generation)));
+	}
+
+	pub fn cancel(&mut self, key: usize) {
+		if key < self.generations.len() {
+			self.bump(key);
+		}
+	}
+
+	pub fn clear(&mut self) {
+		self.heap.clear();
+	}
+
+	// removes and returns the next key whose deadline is before now
+	pub fn pop_expired(&mut self, now: Instant) -> Option<usize> {
+		while let Some(Reverse((deadline, key, generation))) = self.heap.peek() {
+			if *deadline >= now {
+				return None
+			}
+
+			let (key, generation) = (*key, *generation);
+			self.heap.pop();
+
+			if self.generations[key] == generation {
+				self.bump(key);
+				return Some(key)
+			}
+		}
+
+		None
+	}
+
+	fn bump(&mut self, key: usize) -> u32 {
+		if key >= self.generations.len() {
+			self.generations.resize(key + 1, 0);
+		}
+
+		let generation = &mut self.generations[key];
+		*generation = generation.wrapping_add(1);
+		*generation
+	}
+}
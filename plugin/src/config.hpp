@@ -4,3 +4,6 @@
 #define PLUGIN_VERSION "0.2.0-dev.0"
 #define PLUGIN_AUTHORS "Patrick Winters"
 #define PLUGIN_LICENCE "MIT/Apache 2.0"
+
+#define COMMAND_PREFIX ".bars "
+#define COMMAND_PREFIX_LEN ((size_t)6)
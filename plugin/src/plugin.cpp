@@ -3,10 +3,16 @@
 
 #include <cstring>
 
-#define COMMAND_PREFIX ".bars "
-#define COMMAND_PREFIX_LEN ((size_t)6)
 #define SCREEN_NAME "lighting control panel"
 
+// time spent handling server messages per timer tick, anything left over is
+// handled over the following frames
+const uint32_t TICK_BUDGET_MS = 20;
+// time spent on left over messages per frame, shared by all screens
+const uint32_t BACKLOG_BUDGET_MS = 4;
+// screens refreshing within this long of each other are drawing one frame
+const ULONGLONG FRAME_MS = 16;
+
 Plugin::Plugin(client::Context *ctx)
 	: CPlugIn(
 			EuroScope::COMPATIBILITY_CODE, PLUGIN_NAME, PLUGIN_VERSION,
@@ -95,7 +101,23 @@ void Plugin::OnTimer(int) {
 		display_error("", "Disconnected automatically");
 	}
 
-	client::client_tick(ctx_);
+	tick(TICK_BUDGET_MS);
+}
+
+void Plugin::tick_backlog() {
+	if (!backlog_)
+		return;
+
+	ULONGLONG now = GetTickCount64();
+	if (now - backlog_tick_ < FRAME_MS)
+		return;
+
+	backlog_tick_ = now;
+	tick(BACKLOG_BUDGET_MS);
+}
+
+void Plugin::tick(uint32_t budget_ms) {
+	backlog_ = client::client_tick(ctx_, budget_ms);
 
 	const char *message;
 	while ((message = client::client_next_message(ctx_)))
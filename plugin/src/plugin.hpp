@@ -8,6 +8,8 @@
 class Plugin : public EuroScope::CPlugIn {
 private:
 	client::Context *ctx_;
+	bool backlog_ = false;
+	ULONGLONG backlog_tick_ = 0;
 
 public:
 	Plugin(client::Context *ctx);
@@ -19,6 +21,12 @@ public:
 	bool OnCompileCommand(const char *) override;
 	void OnTimer(int) override;
 
+	// continues handling server messages left over from the last tick, called
+	// on each refresh so that a backlog clears well before the next timer. with
+	// several screens, only the first to refresh in a frame does any work.
+	void tick_backlog();
+
 private:
+	void tick(uint32_t budget_ms);
 	void display_error(const char *sender, const char *message);
 };
@@ -1,10 +1,14 @@
 #include "screen.hpp"
+#include "config.hpp"
+#include "plugin.hpp"
 
 #include <algorithm>
 #include <cctype>
 #include <cmath>
+#include <cstring>
 #include <format>
 #include <optional>
+#include <string>
 
 #include <gdiplus.h>
 #include <gdiplusgraphics.h>
@@ -22,6 +26,12 @@ const Gdiplus::Color COLOR_MENU_CONTROLLING(0x16, 0x65, 0x34);
 const Gdiplus::Color COLOR_MENU_FOREGROUND(0xcc, 0xcc, 0xcc);
 const Gdiplus::Color COLOR_MENU_MESSAGE(0xff, 0xff, 0xff);
 
+// colour treated as transparent when compositing the cached foreground layer.
+// the client nudges style colours away from it (see FOREGROUND_KEY in
+// screen.rs), and the same is done here for the background colour.
+const COLORREF COLOR_FOREGROUND_KEY = RGB(0xfe, 0x00, 0xfe);
+const COLORREF COLOR_FOREGROUND_NUDGED = RGB(0xfe, 0x00, 0xff);
+
 const Gdiplus::Point ICON_DISCONNECTED[] = {
 	{4, 4}, {8, 8}, {6, 6}, {4, 8}, {8, 4}
 };
@@ -32,8 +42,6 @@ const int ICON_N_POINTS = 5;
 const int SCREEN_OBJECT_CLICK_REGION = 1;
 const int SCREEN_OBJECT_MENU = 2;
 
-const size_t AERODROME_SIZE = 4;
-
 enum class TagFunctionType {
 	None,
 	OpenMenu,
@@ -61,6 +69,19 @@ union TagFunction {
 	operator int() const { return value; }
 };
 
+static std::string format_timing(const char *name, const client::Timing &t) {
+	return std::format(
+		"{}: p50 {:.1f}ms, p95 {:.1f}ms, max {:.1f}ms ({} samples)", name,
+		t.p50 / 1000.0, t.p95 / 1000.0, t.max / 1000.0, t.samples
+	);
+}
+
+static bool is_same_position(
+	const EuroScope::CPosition &a, const EuroScope::CPosition &b
+) {
+	return a.m_Latitude == b.m_Latitude && a.m_Longitude == b.m_Longitude;
+}
+
 static std::optional<std::string> normalise_icao(const char *icao) {
 	if (!icao || !icao[0])
 		return std::nullopt;
@@ -76,7 +97,7 @@ static std::optional<std::string> normalise_icao(const char *icao) {
 	return s;
 }
 
-Screen::Screen(client::Context *ctx, bool geo, EuroScope::CPlugIn *plugin)
+Screen::Screen(client::Context *ctx, bool geo, Plugin *plugin)
 	: geo_(geo), ctx_(ctx), plugin_(plugin) {
 	using namespace Gdiplus;
 
@@ -84,9 +105,25 @@ Screen::Screen(client::Context *ctx, bool geo, EuroScope::CPlugIn *plugin)
 
 	font_family_ = new FontFamily(L"EuroScope");
 	font_ = new Font(font_family_, HEIGHT, FontStyleRegular, UnitPixel);
+
+	brush_menu_ = new SolidBrush(COLOR_MENU_DISCONNECTED);
+	brush_text_ = new SolidBrush(COLOR_MENU_FOREGROUND);
+	brush_message_ = new SolidBrush(COLOR_MENU_MESSAGE);
+	pen_icon_ = new Pen(COLOR_MENU_FOREGROUND, 1);
 }
 
 Screen::~Screen() {
+	release_graphics();
+	release_foreground();
+
+	delete menu_cached_;
+	delete menu_bitmap_;
+
+	delete pen_icon_;
+	delete brush_message_;
+	delete brush_text_;
+	delete brush_menu_;
+
 	delete font_;
 	delete font_family_;
 }
@@ -108,20 +145,21 @@ void Screen::OnAsrContentLoaded(bool loaded) {
 void Screen::OnRefresh(HDC hdc, int phase) {
 	using namespace Gdiplus;
 
+	if (phase == EuroScope::REFRESH_PHASE_BEFORE_TAGS)
+		plugin_->tick_backlog();
+
 	if (phase == EuroScope::REFRESH_PHASE_BACK_BITMAP) {
 		const wchar_t *message = nullptr;
 		if (!geo_) {
 			if (!is_connected()) {
 				message = L"Disconnected";
-			} else if (!client::client_get_views(screen_)[0]) {
+			} else if (!client::client_get_view_count(screen_)) {
 				message = L"No views defined";
 			}
 		}
 
 		if (message) {
-			Graphics *ctx = Graphics::FromHDC(hdc);
-
-			SolidBrush brush(COLOR_MENU_MESSAGE);
+			Graphics *ctx = get_graphics(hdc, phase);
 
 			auto rect = GetRadarArea();
 
@@ -132,21 +170,61 @@ void Screen::OnRefresh(HDC hdc, int phase) {
 
 			origin.X -= text_bbox.Width / 2;
 
-			ctx->DrawString(message, -1, font_, origin, &brush);
-
-			delete ctx;
+			ctx->DrawString(message, -1, font_, origin, brush_message_);
 		} else {
 			auto viewport = get_viewport();
 			client::client_draw_background(screen_, hdc, viewport);
 		}
 	} else if (phase == EuroScope::REFRESH_PHASE_BEFORE_TAGS) {
+		// the non-geo transform also depends on the selected view, so only geo
+		// viewports are compared
 		auto viewport = get_viewport();
-		client::client_set_viewport(screen_, viewport);
+		if (!geo_ || !viewport_set_ ||
+		    std::memcmp(&*viewport_set_, &viewport, sizeof(viewport))) {
+			client::client_set_viewport(screen_, viewport);
+			viewport_set_ = viewport;
+		}
 
-		Graphics *ctx = Graphics::FromHDC(hdc);
+		Graphics *ctx = get_graphics(hdc, phase);
 
 		auto hdc2 = ctx->GetHDC();
-		client::client_draw_foreground(screen_, hdc2);
+
+		bool resized = prepare_foreground(hdc2);
+		bool moved = sync_foreground(hdc2);
+		if (resized || moved || client::client_is_foreground_dirty(screen_)) {
+			// the key fills the whole layer, and drawing is then clipped and
+			// transformed as it would be on the target
+			RECT layer = {0, 0, foreground_size_.cx, foreground_size_.cy};
+			ModifyWorldTransform(foreground_dc_, nullptr, MWT_IDENTITY);
+			SelectClipRgn(foreground_dc_, nullptr);
+			FillRect(foreground_dc_, &layer, foreground_key_);
+			SelectClipRgn(foreground_dc_, foreground_clip_);
+			SetWorldTransform(foreground_dc_, &foreground_xform_);
+
+			SetBkMode(foreground_dc_, GetBkMode(hdc2));
+			COLORREF bk = GetBkColor(hdc2);
+			SetBkColor(
+				foreground_dc_,
+				bk == COLOR_FOREGROUND_KEY ? COLOR_FOREGROUND_NUDGED : bk
+			);
+
+			client::client_draw_foreground(screen_, foreground_dc_);
+		}
+
+		// the layer already holds device pixels, so it is copied without the
+		// target's transform, and only its clip applies
+		bool transformed = GetGraphicsMode(hdc2) == GM_ADVANCED;
+		if (transformed)
+			ModifyWorldTransform(hdc2, nullptr, MWT_IDENTITY);
+
+		TransparentBlt(
+			hdc2, 0, 0, foreground_size_.cx, foreground_size_.cy, foreground_dc_, 0,
+			0, foreground_size_.cx, foreground_size_.cy, COLOR_FOREGROUND_KEY
+		);
+
+		if (transformed)
+			SetWorldTransform(hdc2, &foreground_xform_);
+
 		ctx->ReleaseHDC(hdc2);
 
 		size_t n;
@@ -154,23 +232,22 @@ void Screen::OnRefresh(HDC hdc, int phase) {
 		for (size_t i = 0; i < n; i++) {
 			AddScreenObject(SCREEN_OBJECT_CLICK_REGION, "", rects[i], false, "");
 		}
-
-		delete ctx;
 	} else if (phase == EuroScope::REFRESH_PHASE_AFTER_LISTS) {
-		Graphics *ctx = Graphics::FromHDC(hdc);
+		Graphics *ctx = get_graphics(hdc, phase);
 
-		Color color_menu = COLOR_MENU_DISCONNECTED;
-		const Point *points = ICON_DISCONNECTED;
+		MenuContent content = {
+			L"BARS", ICON_DISCONNECTED, COLOR_MENU_DISCONNECTED.GetValue()
+		};
 		const char *aerodrome = client::client_get_aerodrome(screen_);
 
 		switch (client::client_connection_state(ctx_)) {
 		case client::ConnectionState::ConnectedDirect:
 		case client::ConnectionState::ConnectedProxy:
-			points = ICON_DIRECT;
+			content.icon = ICON_DIRECT;
 			break;
 
 		case client::ConnectionState::ConnectedLocal:
-			points = ICON_LOCAL;
+			content.icon = ICON_LOCAL;
 			break;
 
 		default:;
@@ -179,71 +256,50 @@ void Screen::OnRefresh(HDC hdc, int phase) {
 		if (is_connected() && aerodrome) {
 			switch (client::client_get_activity(screen_)) {
 			case client::ActivityState::Observing:
-				color_menu = COLOR_MENU_OBSERVING;
+				content.color = COLOR_MENU_OBSERVING.GetValue();
 				break;
 
 			case client::ActivityState::Controlling:
-				color_menu = COLOR_MENU_CONTROLLING;
+				content.color = COLOR_MENU_CONTROLLING.GetValue();
 				break;
 
 			default:;
 			}
 		}
 
-		SolidBrush brush_menu(color_menu);
-		SolidBrush brush_text(COLOR_MENU_FOREGROUND);
-		Pen pen_icon(COLOR_MENU_FOREGROUND, 1);
-
-		wchar_t menu_text[AERODROME_SIZE + 1] = L"BARS";
 		if (aerodrome) {
 			size_t i = 0;
 			while (i < AERODROME_SIZE && aerodrome[i]) {
-				menu_text[i] = (wchar_t)aerodrome[i];
+				content.text[i] = (wchar_t)aerodrome[i];
 				i++;
 			}
 		}
 
+		if (!menu_bitmap_ || content != menu_content_)
+			render_menu(ctx, content);
+
 		auto rect = GetRadarArea();
 
 		auto dx = std::min(menu_x ? menu_x : 2L, rect.right - rect.left - 40);
 		auto dy = std::min(menu_y ? menu_y : 2L, rect.bottom - rect.top - 20);
-		PointF origin(rect.right - dx - 2 * PADDING - HEIGHT, rect.top + dy);
-		RectF text_bbox;
-
-		ctx->MeasureString(menu_text, AERODROME_SIZE, font_, origin, &text_bbox);
-
-		auto width = text_bbox.Width;
-		origin.X -= width;
-
-		int rect_width = width + 2 * PADDING + HEIGHT;
-		int rect_height = 2 * PADDING + HEIGHT;
-
-		ctx->FillRectangle(
-			&brush_menu, (int)origin.X, (int)origin.Y, rect_width, rect_height
-		);
+		long left =
+			(long)(rect.right - dx - 2 * PADDING - HEIGHT - menu_text_width_);
+		long top = rect.top + dy;
+
+		if (ctx->DrawCachedBitmap(menu_cached_, left, top) != Status::Ok) {
+			// cached bitmaps are tied to the device format, so rebuild on failure
+			delete menu_cached_;
+			menu_cached_ = new CachedBitmap(menu_bitmap_, ctx);
+			ctx->DrawCachedBitmap(menu_cached_, left, top);
+		}
 
 		AddScreenObject(
 			SCREEN_OBJECT_MENU, "",
-			{(long)origin.X, (long)origin.Y, (long)origin.X + rect_width,
-		   (long)origin.Y + rect_height},
+			{left, top, left + (long)menu_bitmap_->GetWidth(),
+		   top + (long)menu_bitmap_->GetHeight()},
 			true, ""
 		);
 
-		origin.X += PADDING;
-		origin.Y += PADDING;
-
-		auto save = ctx->Save();
-		ctx->TranslateTransform(origin.X, origin.Y);
-		ctx->DrawLines(&pen_icon, points, ICON_N_POINTS);
-		ctx->Restore(save);
-
-		origin.X += HEIGHT;
-		origin.Y -= PADDING;
-
-		ctx->DrawString(menu_text, AERODROME_SIZE, font_, origin, &brush_text);
-
-		delete ctx;
-
 		if (client::client_is_background_refresh_required(screen_))
 			RefreshMapContent();
 
@@ -255,7 +311,42 @@ void Screen::OnRefresh(HDC hdc, int phase) {
 	}
 }
 
-void Screen::OnAsrContentToBeClosed() { delete this; }
+bool Screen::OnCompileCommand(const char *command) {
+	if (std::strncmp(command, COMMAND_PREFIX, COMMAND_PREFIX_LEN))
+		return false;
+	command += COMMAND_PREFIX_LEN;
+
+	if (std::strcmp(command, "stats"))
+		return false;
+
+	client::FrameStats stats;
+	client::client_get_frame_stats(screen_, &stats);
+
+	std::string lines[] = {
+		format_timing("background", stats.background),
+		format_timing("foreground", stats.foreground),
+		format_timing("targets", stats.targets),
+		format_timing("click", stats.click),
+		format_timing("tick", stats.tick),
+		std::format(
+			"gdi: {} background calls, {} foreground calls, {} foreground points",
+			stats.background_calls, stats.foreground_calls, stats.foreground_points
+		),
+	};
+
+	for (const auto &line : lines)
+		plugin_->DisplayUserMessage(
+			PLUGIN_NAME, "Stats", line.c_str(), true, true, false, false, false
+		);
+
+	return true;
+}
+
+void Screen::OnAsrContentToBeClosed() {
+	release_graphics();
+	release_foreground();
+	delete this;
+}
 
 void Screen::OnClickScreenObject(
 	int type, const char *, POINT point, RECT area, int button
@@ -340,7 +431,7 @@ void Screen::OnFunctionCall(
 			"Profiles", "", TagFunction(TagFunctionType::OpenSelectProfile, 0)
 		);
 
-		if (*client::client_get_presets(screen_))
+		if (client::client_get_preset_count(screen_))
 			plugin_->AddPopupListElement(
 				"Presets", "",
 				TagFunction(
@@ -474,6 +565,146 @@ void Screen::OnFunctionCall(
 		RefreshMapContent();
 }
 
+Gdiplus::Graphics *Screen::get_graphics(HDC hdc, int phase) {
+	auto area = GetRadarArea();
+	auto &cache = graphics_[phase];
+
+	// the graphics object captures the state of the DC when created, so one is
+	// kept per phase and only reused whilst the DC and the area it covers remain
+	// the same
+	if (cache.graphics && (cache.hdc != hdc || !EqualRect(&cache.area, &area))) {
+		delete cache.graphics;
+		cache.graphics = nullptr;
+	}
+
+	if (!cache.graphics) {
+		cache.hdc = hdc;
+		cache.area = area;
+		cache.graphics = Gdiplus::Graphics::FromHDC(hdc);
+		return cache.graphics;
+	}
+
+	// EuroScope may change the clip of the same DC between refreshes, so a
+	// reused object takes the current one, and drops any transform left on it
+	cache.graphics->ResetTransform();
+
+	HRGN clip = CreateRectRgn(0, 0, 0, 0);
+	if (GetClipRgn(hdc, clip) == 1) {
+		Gdiplus::Region region(clip);
+		cache.graphics->SetClip(&region);
+	} else {
+		cache.graphics->ResetClip();
+	}
+	DeleteObject(clip);
+
+	return cache.graphics;
+}
+
+void Screen::render_menu(
+	Gdiplus::Graphics *target, const MenuContent &content
+) {
+	using namespace Gdiplus;
+
+	RectF text_bbox;
+	target->MeasureString(
+		content.text, AERODROME_SIZE, font_, PointF(0, 0), &text_bbox
+	);
+
+	menu_text_width_ = text_bbox.Width;
+
+	int rect_width = menu_text_width_ + 2 * PADDING + HEIGHT;
+	int rect_height = 2 * PADDING + HEIGHT;
+
+	delete menu_cached_;
+	delete menu_bitmap_;
+
+	menu_bitmap_ = new Bitmap(rect_width, rect_height, PixelFormat32bppPARGB);
+
+	{
+		Graphics ctx(menu_bitmap_);
+
+		brush_menu_->SetColor(Color(content.color));
+		ctx.FillRectangle(brush_menu_, 0, 0, rect_width, rect_height);
+
+		ctx.TranslateTransform(PADDING, PADDING);
+		ctx.DrawLines(pen_icon_, content.icon, ICON_N_POINTS);
+		ctx.ResetTransform();
+
+		ctx.DrawString(
+			content.text, AERODROME_SIZE, font_, PointF(PADDING + HEIGHT, 0),
+			brush_text_
+		);
+	}
+
+	menu_cached_ = new CachedBitmap(menu_bitmap_, target);
+	menu_content_ = content;
+}
+
+bool Screen::prepare_foreground(HDC hdc) {
+	auto area = GetRadarArea();
+	SIZE size = {area.right, area.bottom};
+
+	if (foreground_dc_ && foreground_size_.cx == size.cx &&
+	    foreground_size_.cy == size.cy)
+		return false;
+
+	release_foreground();
+
+	foreground_dc_ = CreateCompatibleDC(hdc);
+	foreground_bitmap_ = CreateCompatibleBitmap(hdc, size.cx, size.cy);
+	foreground_default_ = SelectObject(foreground_dc_, foreground_bitmap_);
+	foreground_key_ = CreateSolidBrush(COLOR_FOREGROUND_KEY);
+	foreground_size_ = size;
+	SetGraphicsMode(foreground_dc_, GM_ADVANCED);
+
+	return true;
+}
+
+bool Screen::sync_foreground(HDC hdc) {
+	HRGN clip = CreateRectRgn(0, 0, 0, 0);
+	if (GetClipRgn(hdc, clip) != 1) {
+		DeleteObject(clip);
+		clip = nullptr;
+	}
+
+	XFORM xform = {1, 0, 0, 1, 0, 0};
+	if (GetGraphicsMode(hdc) == GM_ADVANCED)
+		GetWorldTransform(hdc, &xform);
+
+	bool changed = !clip != !foreground_clip_ ||
+	               (clip && !EqualRgn(clip, foreground_clip_)) ||
+	               std::memcmp(&xform, &foreground_xform_, sizeof(xform));
+
+	if (foreground_clip_)
+		DeleteObject(foreground_clip_);
+	foreground_clip_ = clip;
+	foreground_xform_ = xform;
+
+	return changed;
+}
+
+void Screen::release_foreground() {
+	if (foreground_dc_) {
+		SelectObject(foreground_dc_, foreground_default_);
+		DeleteDC(foreground_dc_);
+		DeleteObject(foreground_bitmap_);
+		DeleteObject(foreground_key_);
+		foreground_dc_ = nullptr;
+	}
+
+	if (foreground_clip_) {
+		DeleteObject(foreground_clip_);
+		foreground_clip_ = nullptr;
+	}
+}
+
+void Screen::release_graphics() {
+	for (auto &cache : graphics_) {
+		delete cache.graphics;
+		cache.graphics = nullptr;
+	}
+}
+
 client::Viewport Screen::get_viewport() {
 	client::Viewport viewport;
 	auto area = GetRadarArea();
@@ -482,9 +713,16 @@ client::Viewport Screen::get_viewport() {
 		EuroScope::CPosition geo_origin, geo_min, geo_max, geo_lat, geo_lon;
 		POINT pos_min, pos_lat, pos_lon;
 
-		geo_origin = ConvertCoordFromPixelToPosition({0, 0});
-
 		GetDisplayArea(&geo_min, &geo_max);
+
+		// the projection only changes with the display or radar area, so the
+		// conversions below are skipped while neither has moved
+		if (viewport_ && EqualRect(&viewport_area_, &area) &&
+		    is_same_position(viewport_min_, geo_min) &&
+		    is_same_position(viewport_max_, geo_max))
+			return *viewport_;
+
+		geo_origin = ConvertCoordFromPixelToPosition({0, 0});
 		geo_lat.m_Latitude = geo_max.m_Latitude;
 		geo_lon.m_Latitude = geo_min.m_Latitude;
 		geo_lat.m_Longitude = geo_min.m_Longitude;
@@ -512,6 +750,11 @@ client::Viewport Screen::get_viewport() {
 
 		viewport.geo.size[0] = area.right - area.left;
 		viewport.geo.size[1] = area.bottom;
+
+		viewport_min_ = geo_min;
+		viewport_max_ = geo_max;
+		viewport_area_ = area;
+		viewport_ = viewport;
 	} else {
 		viewport.non_geo.origin[0] = viewport.non_geo.origin[1] = 0.0;
 
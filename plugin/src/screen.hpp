@@ -7,8 +7,27 @@
 
 #include <gdiplus.h>
 
+#include <optional>
+
+const size_t AERODROME_SIZE = 4;
+
+class Plugin;
 union TagFunction;
 
+struct GraphicsCache {
+	HDC hdc;
+	RECT area;
+	Gdiplus::Graphics *graphics;
+};
+
+struct MenuContent {
+	wchar_t text[AERODROME_SIZE + 1];
+	const Gdiplus::Point *icon;
+	Gdiplus::ARGB color;
+
+	bool operator==(const MenuContent &) const = default;
+};
+
 class Screen : public EuroScope::CRadarScreen {
 private:
 	bool geo_;
@@ -19,15 +38,43 @@ private:
 	Gdiplus::FontFamily *font_family_;
 	Gdiplus::Font *font_;
 
+	Gdiplus::SolidBrush *brush_menu_;
+	Gdiplus::SolidBrush *brush_text_;
+	Gdiplus::SolidBrush *brush_message_;
+	Gdiplus::Pen *pen_icon_;
+
+	MenuContent menu_content_ = {};
+	Gdiplus::Bitmap *menu_bitmap_ = nullptr;
+	Gdiplus::CachedBitmap *menu_cached_ = nullptr;
+	Gdiplus::REAL menu_text_width_ = 0;
+
+	GraphicsCache graphics_[EuroScope::REFRESH_PHASE_AFTER_LISTS + 1] = {};
+
+	HDC foreground_dc_ = nullptr;
+	HBITMAP foreground_bitmap_ = nullptr;
+	HGDIOBJ foreground_default_ = nullptr;
+	HBRUSH foreground_key_ = nullptr;
+	SIZE foreground_size_ = {};
+	// clip region and transform of the target when the layer was last drawn
+	HRGN foreground_clip_ = nullptr;
+	XFORM foreground_xform_ = {1, 0, 0, 1, 0, 0};
+
+	// the last geo viewport and the display and radar areas it was computed
+	// from, and the last viewport passed to the client
+	EuroScope::CPosition viewport_min_, viewport_max_;
+	RECT viewport_area_ = {};
+	std::optional<client::Viewport> viewport_;
+	std::optional<client::Viewport> viewport_set_;
+
 	long menu_x = 0, menu_y = 0;
 
 	TagFunction *pending_function_ = nullptr;
 	RECT pending_function_area_;
 
-	EuroScope::CPlugIn *plugin_;
+	Plugin *plugin_;
 
 public:
-	Screen(client::Context *ctx, bool geo, EuroScope::CPlugIn *plugin);
+	Screen(client::Context *ctx, bool geo, Plugin *plugin);
 	~Screen();
 	Screen(const Screen &) = delete;
 	Screen &operator=(const Screen &) = delete;
@@ -35,11 +82,21 @@ public:
 	void OnAsrContentLoaded(bool) override;
 	void OnRefresh(HDC, int) override;
 	void OnAsrContentToBeClosed() override;
+	bool OnCompileCommand(const char *) override;
 	void OnClickScreenObject(int, const char *, POINT, RECT, int) override;
 	void OnMoveScreenObject(int, const char *, POINT, RECT, bool) override;
 	void OnFunctionCall(int, const char *, POINT, RECT) override;
 
 private:
+	Gdiplus::Graphics *get_graphics(HDC hdc, int phase);
+	void release_graphics();
+	void render_menu(Gdiplus::Graphics *target, const MenuContent &content);
+	bool prepare_foreground(HDC hdc);
+	// takes the clip region and transform of hdc for the layer, returning
+	// whether they changed since it was drawn
+	bool sync_foreground(HDC hdc);
+	void release_foreground();
+
 	client::Viewport get_viewport();
 	bool is_connected();
 };
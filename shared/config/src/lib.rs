@@ -1,5 +1,5 @@
 use std::fmt::Debug;
-use std::io::{Read, Write};
+use std::io::{Read, Seek, SeekFrom, Write};
 
 pub use bincode;
 use bincode::{DefaultOptions, ErrorKind, Options};
@@ -11,12 +11,43 @@ use flate2::Compression;
 use serde::{Deserialize, Serialize};
 
 static MAGIC: &[u8] = b"\xffBARS\x13eu";
-const VERSION: u16 = 0;
+static INDEX_MAGIC: &[u8] = b"\xffBARS\x13ix";
+// bumped whenever the encoding changes. files of any other version are
+// rejected rather than migrated, so published configs are recompiled with a
+// matching confc and republished alongside the release that bumps it.
+pub const VERSION: u16 = 1;
+
+// douglas-peucker tolerances of the levels of detail stored for paths, in
+// source units. geo paths are measured in degrees of latitude, with their
+// longitudes scaled by the cosine of the latitude so that the error is the
+// same in every direction. level 0 is the full path.
+pub static LOD_TOLERANCES: &[f32] = &[0.0, 0.00002, 0.0001, 0.0005, 0.002];
+
+// the most profiles, nodes or blocks an aerodrome may have
+pub const MAX_INDEXED: usize = u16::MAX as usize;
 
 fn bincode_options() -> impl Options {
 	DefaultOptions::new().with_limit(0x100_0000)
 }
 
+fn check_version(reader: &mut impl Read) -> bincode::Result<()> {
+	let mut buf = [0; 2];
+	reader.read_exact(&mut buf)?;
+
+	let version = u16::from_be_bytes(buf);
+	if version != VERSION {
+		return Err(
+			ErrorKind::Custom(format!(
+				"unsupported config version {version} (expected {VERSION}), \
+				 recompile it with a matching confc"
+			))
+			.into(),
+		)
+	}
+
+	Ok(())
+}
+
 #[derive(Clone, Debug, Deserialize, Serialize)]
 pub struct Config {
 	pub name: Option<String>,
@@ -34,15 +65,16 @@ impl Config {
 			return Err(ErrorKind::Custom("invalid config file".into()).into())
 		}
 
-		let mut buf = [0; 2];
-		reader.read_exact(&mut buf)?;
+		check_version(&mut reader)?;
+
+		let reader = DeflateDecoder::new(reader);
+		let config: Self = bincode_options().deserialize_from(reader)?;
 
-		if buf != VERSION.to_be_bytes() {
-			return Err(ErrorKind::Custom("unsupported config version".into()).into())
+		for aerodrome in &config.aerodromes {
+			aerodrome.check_limits()?;
 		}
 
-		let reader = DeflateDecoder::new(reader);
-		bincode_options().deserialize_from(reader)
+		Ok(config)
 	}
 
 	pub fn save(&self, mut writer: impl Write) -> bincode::Result<()> {
@@ -52,6 +84,120 @@ impl Config {
 		let writer = DeflateEncoder::new(writer, Compression::best());
 		bincode_options().serialize_into(writer, self)
 	}
+
+	// writes the config with each aerodrome compressed separately, so that a
+	// single aerodrome can be read back through an Index
+	pub fn save_indexed(&self, mut writer: impl Write) -> bincode::Result<()> {
+		let mut entries = Vec::with_capacity(self.aerodromes.len());
+		let mut blobs = Vec::with_capacity(self.aerodromes.len());
+		let mut offset = 0;
+
+		for aerodrome in &self.aerodromes {
+			let mut encoder = DeflateEncoder::new(Vec::new(), Compression::best());
+			bincode_options().serialize_into(&mut encoder, aerodrome)?;
+			let blob = encoder.finish()?;
+
+			entries.push(IndexEntry {
+				icao: aerodrome.icao.clone(),
+				offset,
+				length: blob.len() as u64,
+			});
+
+			offset += blob.len() as u64;
+			blobs.push(blob);
+		}
+
+		let header = bincode_options().serialize(&IndexHeader {
+			name: self.name.clone(),
+			version: self.version.clone(),
+			entries,
+		})?;
+
+		writer.write_all(&INDEX_MAGIC)?;
+		writer.write_all(&VERSION.to_be_bytes())?;
+		writer.write_all(&(header.len() as u64).to_le_bytes())?;
+		writer.write_all(&header)?;
+
+		for blob in blobs {
+			writer.write_all(&blob)?;
+		}
+
+		Ok(())
+	}
+}
+
+#[derive(Deserialize, Serialize)]
+struct IndexHeader {
+	name: Option<String>,
+	version: Option<String>,
+	entries: Vec<IndexEntry>,
+}
+
+#[derive(Deserialize, Serialize)]
+struct IndexEntry {
+	icao: String,
+	offset: u64,
+	length: u64,
+}
+
+// the header of a config written by Config::save_indexed, from which single
+// aerodromes can be decoded without reading the rest of the file
+pub struct Index {
+	pub name: Option<String>,
+	pub version: Option<String>,
+	entries: Vec<IndexEntry>,
+	base: u64,
+}
+
+impl Index {
+	pub fn load(mut reader: impl Read + Seek) -> bincode::Result<Self> {
+		let mut buf = vec![0; INDEX_MAGIC.len()];
+		reader.read_exact(&mut buf)?;
+
+		if buf != INDEX_MAGIC {
+			return Err(ErrorKind::Custom("invalid config index".into()).into())
+		}
+
+		check_version(&mut reader)?;
+
+		let mut buf = [0; 8];
+		reader.read_exact(&mut buf)?;
+		let length = u64::from_le_bytes(buf);
+
+		let header: IndexHeader =
+			bincode_options().deserialize_from((&mut reader).take(length))?;
+		let base = reader.stream_position()?;
+
+		Ok(Self {
+			name: header.name,
+			version: header.version,
+			entries: header.entries,
+			base,
+		})
+	}
+
+	pub fn aerodromes(&self) -> impl Iterator<Item = &str> {
+		self.entries.iter().map(|entry| entry.icao.as_str())
+	}
+
+	pub fn load_aerodrome(
+		&self,
+		mut reader: impl Read + Seek,
+		icao: &str,
+	) -> bincode::Result<Option<Aerodrome>> {
+		let Some(entry) = self.entries.iter().find(|entry| entry.icao == icao)
+		else {
+			return Ok(None)
+		};
+
+		reader.seek(SeekFrom::Start(self.base + entry.offset))?;
+
+		let reader = DeflateDecoder::new(reader.take(entry.length));
+		let aerodrome: Aerodrome = bincode_options().deserialize_from(reader)?;
+		aerodrome.check_limits()?;
+
+		Ok(Some(aerodrome))
+	}
 }
 
 #[derive(Clone, Debug, Deserialize, Serialize)]
@@ -70,6 +216,33 @@ pub struct Aerodrome {
 	pub styles: Vec<Style>,
 }
 
+impl Aerodrome {
+	// patches and click targets refer to profiles, nodes and blocks by u16
+	// index, so aerodromes with more of any are rejected rather than letting
+	// the indices wrap onto other entries
+	pub fn check_limits(&self) -> bincode::Result<()> {
+		let counts = [
+			("profiles", self.profiles.len()),
+			("nodes", self.nodes.len()),
+			("blocks", self.blocks.len()),
+		];
+
+		for (kind, count) in counts {
+			if count > MAX_INDEXED {
+				return Err(
+					ErrorKind::Custom(format!(
+						"{} has {count} {kind}, at most {MAX_INDEXED} are supported",
+						self.icao,
+					))
+					.into(),
+				)
+			}
+		}
+
+		Ok(())
+	}
+}
+
 #[derive(Clone, Debug, Deserialize, Serialize)]
 pub struct Element {
 	pub id: String,
@@ -279,11 +452,17 @@ pub struct GeoPoint {
 pub struct Path<T: Clone + Debug> {
 	pub points: Vec<T>,
 	pub style: usize,
+	// the coarsest level of detail each point is kept at, or empty if the
+	// path is drawn in full at every level
+	pub levels: Vec<u8>,
+	// the smallest and largest of each coordinate over all points
+	pub bounds: (T, T),
 }
 
 #[derive(Clone, Debug, Default, Deserialize, Serialize)]
 pub struct Target<T: Clone + Debug> {
 	pub points: Vec<T>,
+	pub bounds: (T, T),
 }
 
 #[derive(Clone, Debug, Default, Deserialize, Serialize)]
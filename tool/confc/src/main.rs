@@ -1,11 +1,15 @@
 mod map;
 
+use std::cell::Cell;
 use std::collections::{HashMap, VecDeque};
 use std::fs::File;
-use std::io::BufWriter;
-use std::path::PathBuf;
+use std::io::{BufReader, BufWriter, Write};
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Mutex;
+use std::time::{Duration, SystemTime};
 
-use bars_config::{self as lib, Config, Element};
+use bars_config::{self as lib, bincode, Config, Element};
 
 use anyhow::Result;
 
@@ -15,6 +19,8 @@ use kml::KmlReader;
 
 use serde::Deserialize;
 
+use sha2::{Digest, Sha256};
+
 use usvg::Tree;
 
 /// Compile JSON files into a distributable BARS configuration package.
@@ -33,6 +39,11 @@ struct Args {
 	#[arg(short, long, value_name = "FILE")]
 	output: Option<PathBuf>,
 
+	/// reuse aerodromes compiled into DIR whose inputs have not changed.
+	/// entries unused for 30 days are removed.
+	#[arg(short, long, value_name = "DIR")]
+	cache: Option<PathBuf>,
+
 	/// paths to JSON files to process
 	#[arg(value_name = "FILE")]
 	files: Vec<PathBuf>,
@@ -41,79 +52,212 @@ struct Args {
 fn main() -> Result<()> {
 	let args = Args::parse();
 
-	let mut aerodromes = Vec::new();
+	let cache = match &args.cache {
+		Some(dir) => {
+			std::fs::create_dir_all(dir)?;
+
+			// keyed on the compiler binary itself, so that any change to how
+			// aerodromes are compiled invalidates the cache without a version bump.
+			// hashed once per run, which is small next to compiling anything.
+			let build = Sha256::digest(std::fs::read(std::env::current_exe()?)?);
+			Some(Cache { dir, build })
+		},
+		None => None,
+	};
 
-	for file in args.files {
-		let dir = file.parent().unwrap();
+	let aerodromes = parallel(&args.files, |file| load(file, cache.as_ref()))?;
 
-		let s = std::fs::read_to_string(&file)?;
-		let input = serde_json::from_str::<Aerodrome>(&s)?;
+	if let Some(cache) = &cache {
+		cache.prune()?;
+	}
 
-		let mut display = match input.display {
-			GeoMap::Geo(path) => {
-				let mut reader = KmlReader::<_, f32>::from_kmz_path(dir.join(path))?;
-				map::convert(map::Kml::new(reader.read()?).unwrap().input(), 0)
-			},
-			GeoMap::Flat { svg, lat, lon } => {
-				let s = std::fs::read_to_string(dir.join(svg))?;
-				let tree = Tree::from_str(&s, &Default::default())?;
-				map::convert(map::GeoSvg::new(&tree, lat, lon), 0)
-			},
-		};
-		let mut styles = display.styles;
-
-		let mut temp_maps = Vec::new();
-		for svg in input.maps {
-			let s = std::fs::read_to_string(dir.join(svg))?;
-			let tree = Tree::from_str(&s, &Default::default())?;
-			let mut map = map::convert(map::Svg::new(&tree), styles.len());
-			styles.append(&mut map.styles);
-			temp_maps.push(map);
+	let config = Config {
+		name: args.pkg_name,
+		version: args.pkg_version,
+		aerodromes,
+	};
+
+	if let Some(path) = args.output {
+		config.save(BufWriter::new(File::create(path)?))?;
+	} else {
+		config.save(std::io::stdout())?;
+	}
+
+	Ok(())
+}
+
+struct Cache<'a> {
+	dir: &'a Path,
+	build: sha2::digest::Output<Sha256>,
+}
+
+impl Cache<'_> {
+	// entries are touched when reused, so their age is the time since a build
+	// last needed them
+	const MAX_AGE: Duration = Duration::from_secs(30 * 24 * 60 * 60);
+	// temporary files this old were left by an interrupted build
+	const MAX_TEMP_AGE: Duration = Duration::from_secs(60 * 60);
+
+	fn touch(path: &Path) {
+		if let Ok(file) = File::options().write(true).open(path) {
+			let _ = file.set_modified(SystemTime::now());
 		}
+	}
 
-		let mut nodes = Vec::new();
-		let mut node_ids = HashMap::new();
-		for node in input.nodes {
-			let parent = node.parent.map(|id| *node_ids.get(&id).unwrap());
-			let display = display.nodes.remove(&node.id).unwrap_or_default();
-
-			node_ids.insert(node.id.clone(), nodes.len());
-			nodes.push(lib::Node {
-				id: node.id.0,
-				scratchpad: node.scratchpad,
-				parent,
-				display,
-			});
+	fn prune(&self) -> Result<()> {
+		let now = SystemTime::now();
+
+		for entry in std::fs::read_dir(self.dir)? {
+			let path = entry?.path();
+			let max_age = match path.extension().and_then(|s| s.to_str()) {
+				Some("bin") => Self::MAX_AGE,
+				Some("tmp") => Self::MAX_TEMP_AGE,
+				_ => continue,
+			};
+
+			let modified = std::fs::metadata(&path).and_then(|m| m.modified());
+			let age = modified.map(|t| now.duration_since(t).unwrap_or_default());
+			if age.is_ok_and(|age| age > max_age) {
+				let _ = std::fs::remove_file(&path);
+			}
 		}
 
-		let mut edges = Vec::new();
-		let mut id_edges = Vec::new();
-		let mut edge_ids = HashMap::new();
-		for edge in input.edges {
-			let display = display.edges.remove(&edge.id).unwrap_or_default();
+		Ok(())
+	}
+}
+
+// compiles the aerodrome described by a JSON file, or reuses the copy in the
+// cache if neither it nor any of the maps it refers to have changed
+fn load(file: &Path, cache: Option<&Cache>) -> Result<lib::Aerodrome> {
+	static TEMP: AtomicUsize = AtomicUsize::new(0);
+
+	let dir = file.parent().unwrap();
 
-			id_edges.push(edge.id.clone());
-			edge_ids.insert(edge.id, edges.len());
-			edges.push(lib::Edge { display });
+	let s = std::fs::read_to_string(file)?;
+	let input = serde_json::from_str::<Aerodrome>(&s)?;
+
+	let Some(cache) = cache else {
+		return compile(dir, input)
+	};
+
+	// each part is length-prefixed so that no two sets of inputs can collide
+	// by shifting bytes between parts
+	let mut hasher = Sha256::new();
+	hasher.update(cache.build);
+	hasher.update(lib::VERSION.to_le_bytes());
+	for part in std::iter::once(Ok(s.into_bytes()))
+		.chain(input.sources().map(|path| std::fs::read(dir.join(path))))
+	{
+		let part = part?;
+		hasher.update((part.len() as u64).to_le_bytes());
+		hasher.update(part);
+	}
+
+	let key: String = (hasher.finalize().iter())
+		.map(|byte| format!("{byte:02x}"))
+		.collect();
+	let path = cache.dir.join(format!("{key}.bin"));
+	if let Ok(file) = File::open(&path) {
+		if let Ok(aerodrome) = bincode::deserialize_from(BufReader::new(file)) {
+			Cache::touch(&path);
+			return Ok(aerodrome)
 		}
+	}
 
-		let mut edge_conditions = HashMap::new();
-		let mut edge_blocks = HashMap::new();
-
-		let mut blocks = Vec::new();
-		let mut block_ids = HashMap::new();
-		for block in input.blocks {
-			let edges = HashMap::from_iter(block.edges.iter().map(|(id, edges)| {
-				(
-					*node_ids.get(id).unwrap(),
-					edges
-						.0
-						.iter()
-						.map(|id| *edge_ids.get(id).unwrap())
-						.collect(),
-				)
-			}));
-			let joins = block
+	let aerodrome = compile(dir, input)?;
+
+	// replace the entry atomically so an interrupted write is never trusted
+	let temp_path = cache.dir.join(format!(
+		"{key}.{}.{}.tmp",
+		std::process::id(),
+		TEMP.fetch_add(1, Ordering::Relaxed),
+	));
+	{
+		let mut writer = BufWriter::new(File::create(&temp_path)?);
+		bincode::serialize_into(&mut writer, &aerodrome)?;
+		writer.flush()?;
+	}
+	std::fs::rename(&temp_path, &path)?;
+
+	Ok(aerodrome)
+}
+
+fn compile(dir: &Path, input: Aerodrome) -> Result<lib::Aerodrome> {
+	let (display, temp_maps) = join(
+		|| -> Result<_> {
+			Ok(match &input.display {
+				GeoMap::Geo(path) => {
+					let mut reader = KmlReader::<_, f32>::from_kmz_path(dir.join(path))?;
+					map::convert(map::Kml::new(reader.read()?).unwrap().input())
+				},
+				GeoMap::Flat { svg, lat, lon } => {
+					let s = std::fs::read_to_string(dir.join(svg))?;
+					let tree = Tree::from_str(&s, &Default::default())?;
+					map::convert(map::GeoSvg::new(&tree, *lat, *lon))
+				},
+			})
+		},
+		|| {
+			parallel(&input.maps, |svg| {
+				let s = std::fs::read_to_string(dir.join(svg))?;
+				let tree = Tree::from_str(&s, &Default::default())?;
+				Ok(map::convert(map::Svg::new(&tree)))
+			})
+		},
+	);
+	let (mut display, mut temp_maps) = (display?, temp_maps?);
+
+	let mut styles = std::mem::take(&mut display.styles);
+	for map in &mut temp_maps {
+		map.offset_styles(styles.len());
+		styles.append(&mut map.styles);
+	}
+
+	let mut nodes = Vec::new();
+	let mut node_ids = HashMap::new();
+	for node in input.nodes {
+		let parent = node.parent.map(|id| *node_ids.get(&id).unwrap());
+		let display = display.nodes.remove(&node.id).unwrap_or_default();
+
+		node_ids.insert(node.id.clone(), nodes.len());
+		nodes.push(lib::Node {
+			id: node.id.0,
+			scratchpad: node.scratchpad,
+			parent,
+			display,
+		});
+	}
+
+	let mut edges = Vec::new();
+	let mut id_edges = Vec::new();
+	let mut edge_ids = HashMap::new();
+	for edge in input.edges {
+		let display = display.edges.remove(&edge.id).unwrap_or_default();
+
+		id_edges.push(edge.id.clone());
+		edge_ids.insert(edge.id, edges.len());
+		edges.push(lib::Edge { display });
+	}
+
+	let mut edge_conditions = HashMap::new();
+	let mut edge_blocks = HashMap::new();
+
+	let routes = input
+		.blocks
+		.iter()
+		.map(|block| {
+			let edges: HashMap<usize, Vec<usize>> =
+				HashMap::from_iter(block.edges.iter().map(|(id, edges)| {
+					(
+						*node_ids.get(id).unwrap(),
+						edges
+							.0
+							.iter()
+							.map(|id| *edge_ids.get(id).unwrap())
+							.collect(),
+					)
+				}));
+			let joins: Vec<Vec<Vec<usize>>> = block
 				.joins
 				.iter()
 				.map(|vertex| {
@@ -130,220 +274,283 @@ fn main() -> Result<()> {
 				})
 				.collect();
 
-			let resolved = resolve_routes(&edges, &joins);
-			for id in resolved.conditions.keys() {
-				edge_blocks.insert(*id, blocks.len());
-			}
-			edge_conditions.extend(resolved.conditions.into_iter());
+			(edges, joins)
+		})
+		.collect::<Vec<_>>();
 
-			let nodes = block
-				.nodes
-				.iter()
-				.map(|id| *node_ids.get(id).unwrap())
-				.collect();
-			let display = display.blocks.remove(&block.id).unwrap_or_default();
-
-			block_ids.insert(block.id.clone(), blocks.len());
-			blocks.push(lib::Block {
-				id: block.id.0,
-				nodes,
-				edges: Vec::new(), // defect: unused
-				non_routes: resolved.non_routes,
-				stands: block.stands,
-				display,
-			});
-		}
+	// the route search is quadratic in each block's boundary nodes, so blocks
+	// are resolved in parallel
+	let resolved =
+		parallel(&routes, |(edges, joins)| Ok(resolve_routes(edges, joins)))?;
 
-		let mut profiles = Vec::new();
-		for profile in input.profiles {
-			let default_node = profile
-				.nodes
-				.get(&IdList::wildcard())
-				.copied()
-				.unwrap_or_default();
-			let nodes = nodes
-				.iter()
-				.map(|node| {
-					profile
-						.nodes
-						.iter()
-						.find(|(ids, _)| ids.0.contains(&Id(node.id.clone())))
-						.map(|(_, node)| *node)
-						.unwrap_or(default_node)
-						.convert()
-				})
-				.collect::<Vec<_>>();
-
-			let default_edge = profile
-				.edges
-				.get(&IdList::wildcard())
-				.cloned()
-				.unwrap_or_default();
-			let edges = id_edges
-				.iter()
-				.enumerate()
-				.map(|(index, id)| {
-					profile
-						.edges
-						.iter()
-						.find(|(ids, _)| ids.0.contains(id))
-						.map(|(_, edge)| edge.clone())
-						.unwrap_or(default_edge.clone())
-						.convert(
-							&node_ids,
-							edge_blocks
-								.get(&index)
-								.copied()
-								.zip(edge_conditions.get(&index).cloned()),
-						)
-				})
-				.collect();
-
-			let default_block = profile
-				.blocks
-				.get(&IdList::wildcard())
-				.copied()
-				.unwrap_or_default();
-			let blocks = blocks
-				.iter()
-				.map(|block| {
-					profile
-						.blocks
-						.iter()
-						.find(|(ids, _)| ids.0.contains(&Id(block.id.clone())))
-						.map(|(_, block)| *block)
-						.unwrap_or(default_block)
-						.convert()
-				})
-				.collect();
-
-			let presets = profile
-				.presets
-				.into_iter()
-				.map(|preset| lib::Preset {
-					name: preset.name,
-					nodes: preset
-						.nodes
-						.into_iter()
-						.flat_map(|(ids, state)| {
-							let ids = if ids.0.is_empty() {
-								vec![u32::MAX as usize]
-							} else {
-								ids
-									.0
-									.iter()
-									.map(|id| *node_ids.get(id).unwrap())
-									.collect()
-							};
-
-							ids
-								.into_iter()
-								.map(|index| (index, state))
-								.collect::<Vec<_>>()
-						})
-						.collect(),
-					blocks: preset
-						.blocks
-						.into_iter()
-						.flat_map(|(ids, state)| {
-							let state = match state {
-								BlockState::Clear => lib::BlockState::Clear,
-								BlockState::Relax => lib::BlockState::Relax,
-								BlockState::Route((a, b)) => lib::BlockState::Route((
-									*node_ids.get(&a).unwrap(),
-									*node_ids.get(&b).unwrap(),
-								)),
-							};
-
-							let ids = if ids.0.is_empty() {
-								vec![u32::MAX as usize]
-							} else {
-								ids
-									.0
-									.into_iter()
-									.map(|id| *block_ids.get(&id).unwrap())
-									.collect()
-							};
+	let mut blocks = Vec::new();
+	let mut block_ids = HashMap::new();
+	for (block, resolved) in input.blocks.into_iter().zip(resolved) {
+		for id in resolved.conditions.keys() {
+			edge_blocks.insert(*id, blocks.len());
+		}
+		edge_conditions.extend(resolved.conditions.into_iter());
+
+		let nodes = block
+			.nodes
+			.iter()
+			.map(|id| *node_ids.get(id).unwrap())
+			.collect();
+		let display = display.blocks.remove(&block.id).unwrap_or_default();
+
+		block_ids.insert(block.id.clone(), blocks.len());
+		blocks.push(lib::Block {
+			id: block.id.0,
+			nodes,
+			edges: Vec::new(), // defect: unused
+			non_routes: resolved.non_routes,
+			stands: block.stands,
+			display,
+		});
+	}
 
+	let mut profiles = Vec::new();
+	for profile in input.profiles {
+		let default_node = profile
+			.nodes
+			.get(&IdList::wildcard())
+			.copied()
+			.unwrap_or_default();
+		let nodes = nodes
+			.iter()
+			.map(|node| {
+				profile
+					.nodes
+					.iter()
+					.find(|(ids, _)| ids.0.contains(&Id(node.id.clone())))
+					.map(|(_, node)| *node)
+					.unwrap_or(default_node)
+					.convert()
+			})
+			.collect::<Vec<_>>();
+
+		let default_edge = profile
+			.edges
+			.get(&IdList::wildcard())
+			.cloned()
+			.unwrap_or_default();
+		let edges = id_edges
+			.iter()
+			.enumerate()
+			.map(|(index, id)| {
+				profile
+					.edges
+					.iter()
+					.find(|(ids, _)| ids.0.contains(id))
+					.map(|(_, edge)| edge.clone())
+					.unwrap_or(default_edge.clone())
+					.convert(
+						&node_ids,
+						edge_blocks
+							.get(&index)
+							.copied()
+							.zip(edge_conditions.get(&index).cloned()),
+					)
+			})
+			.collect();
+
+		let default_block = profile
+			.blocks
+			.get(&IdList::wildcard())
+			.copied()
+			.unwrap_or_default();
+		let blocks = blocks
+			.iter()
+			.map(|block| {
+				profile
+					.blocks
+					.iter()
+					.find(|(ids, _)| ids.0.contains(&Id(block.id.clone())))
+					.map(|(_, block)| *block)
+					.unwrap_or(default_block)
+					.convert()
+			})
+			.collect();
+
+		let presets = profile
+			.presets
+			.into_iter()
+			.map(|preset| lib::Preset {
+				name: preset.name,
+				nodes: preset
+					.nodes
+					.into_iter()
+					.flat_map(|(ids, state)| {
+						let ids = if ids.0.is_empty() {
+							vec![u32::MAX as usize]
+						} else {
+							ids.0.iter().map(|id| *node_ids.get(id).unwrap()).collect()
+						};
+
+						ids
+							.into_iter()
+							.map(|index| (index, state))
+							.collect::<Vec<_>>()
+					})
+					.collect(),
+				blocks: preset
+					.blocks
+					.into_iter()
+					.flat_map(|(ids, state)| {
+						let state = match state {
+							BlockState::Clear => lib::BlockState::Clear,
+							BlockState::Relax => lib::BlockState::Relax,
+							BlockState::Route((a, b)) => lib::BlockState::Route((
+								*node_ids.get(&a).unwrap(),
+								*node_ids.get(&b).unwrap(),
+							)),
+						};
+
+						let ids = if ids.0.is_empty() {
+							vec![u32::MAX as usize]
+						} else {
 							ids
+								.0
 								.into_iter()
-								.map(move |index| (index, state))
-						})
-						.collect(),
-				})
-				.collect();
+								.map(|id| *block_ids.get(&id).unwrap())
+								.collect()
+						};
 
-			profiles.push(lib::Profile {
-				id: profile.id.0,
-				name: profile.name,
-				nodes,
-				edges,
-				blocks,
-				presets,
-			});
-		}
+						ids.into_iter().map(move |index| (index, state))
+					})
+					.collect(),
+			})
+			.collect();
 
-		let mut maps = Vec::new();
-		let mut views = Vec::new();
-		for map in temp_maps {
-			let mut nodes = vec![Default::default(); nodes.len()];
-			for (id, node) in map.nodes {
-				nodes[*node_ids.get(&id).unwrap()] = node;
-			}
+		profiles.push(lib::Profile {
+			id: profile.id.0,
+			name: profile.name,
+			nodes,
+			edges,
+			blocks,
+			presets,
+		});
+	}
 
-			let mut edges = vec![Default::default(); edges.len()];
-			for (id, edge) in map.edges {
-				edges[*edge_ids.get(&id).unwrap()] = edge;
-			}
+	let mut maps = Vec::new();
+	let mut views = Vec::new();
+	for map in temp_maps {
+		let mut nodes = vec![Default::default(); nodes.len()];
+		for (id, node) in map.nodes {
+			nodes[*node_ids.get(&id).unwrap()] = node;
+		}
 
-			let mut blocks = vec![Default::default(); blocks.len()];
-			for (id, block) in map.blocks {
-				blocks[*block_ids.get(&id).unwrap()] = block;
-			}
+		let mut edges = vec![Default::default(); edges.len()];
+		for (id, edge) in map.edges {
+			edges[*edge_ids.get(&id).unwrap()] = edge;
+		}
 
-			for (name, (min, max)) in map.views {
-				views.push(lib::View {
-					name,
-					map: maps.len(),
-					bounds: lib::Box { min, max },
-				});
-			}
+		let mut blocks = vec![Default::default(); blocks.len()];
+		for (id, block) in map.blocks {
+			blocks[*block_ids.get(&id).unwrap()] = block;
+		}
 
-			maps.push(lib::Map {
-				background: Default::default(), // todo
-				base: map.base,
-				nodes,
-				edges,
-				blocks,
+		for (name, (min, max)) in map.views {
+			views.push(lib::View {
+				name,
+				map: maps.len(),
+				bounds: lib::Box { min, max },
 			});
 		}
 
-		aerodromes.push(lib::Aerodrome {
-			icao: input.icao,
-			elements: input.elements,
+		maps.push(lib::Map {
+			background: Default::default(), // todo
+			base: map.base,
 			nodes,
 			edges,
 			blocks,
-			profiles,
-			maps,
-			views,
-			styles,
 		});
 	}
 
-	let config = Config {
-		name: args.pkg_name,
-		version: args.pkg_version,
-		aerodromes,
+	let aerodrome = lib::Aerodrome {
+		icao: input.icao,
+		elements: input.elements,
+		nodes,
+		edges,
+		blocks,
+		profiles,
+		maps,
+		views,
+		styles,
 	};
 
-	if let Some(path) = args.output {
-		config.save(BufWriter::new(File::create(path)?))?;
+	aerodrome.check_limits()?;
+
+	Ok(aerodrome)
+}
+
+thread_local! {
+	// set on threads started by parallel and join, so that nested calls run
+	// in line rather than starting another set of threads per core
+	static WORKER: Cell<bool> = const { Cell::new(false) };
+}
+
+// runs a on another thread while b runs on this one
+fn join<A: Send, B>(
+	a: impl FnOnce() -> A + Send,
+	b: impl FnOnce() -> B,
+) -> (A, B) {
+	if WORKER.get() {
+		return (a(), b())
+	}
+
+	std::thread::scope(|scope| {
+		let a = scope.spawn(|| {
+			WORKER.set(true);
+			a()
+		});
+
+		let b = b();
+		(a.join().unwrap(), b)
+	})
+}
+
+// runs f over each item on up to one thread per core, returning the results
+// in order or the first error. only the outermost call is parallel.
+fn parallel<T: Sync, U: Send>(
+	items: &[T],
+	f: impl Fn(&T) -> Result<U> + Sync,
+) -> Result<Vec<U>> {
+	let threads = if WORKER.get() {
+		1
 	} else {
-		config.save(std::io::stdout())?;
+		std::thread::available_parallelism()
+			.map_or(1, |n| n.get())
+			.min(items.len())
+	};
+
+	// a single item keeps the thread free to parallelise inside f
+	if threads <= 1 {
+		return items.iter().map(f).collect()
 	}
 
-	Ok(())
+	let next = AtomicUsize::new(0);
+	let results = Mutex::new(Vec::from_iter(items.iter().map(|_| None)));
+
+	std::thread::scope(|scope| {
+		for _ in 0..threads {
+			scope.spawn(|| {
+				WORKER.set(true);
+
+				loop {
+					let i = next.fetch_add(1, Ordering::Relaxed);
+					let Some(item) = items.get(i) else { break };
+
+					let result = f(item);
+					results.lock().unwrap()[i] = Some(result);
+				}
+			});
+		}
+	});
+
+	(results.into_inner().unwrap().into_iter())
+		.map(|result| result.unwrap())
+		.collect()
 }
 
 fn resolve_routes(
@@ -489,6 +696,18 @@ pub struct Aerodrome {
 	maps: Vec<Map>,
 }
 
+impl Aerodrome {
+	// the map files the aerodrome is compiled from
+	fn sources(&self) -> impl Iterator<Item = &PathBuf> {
+		let display = match &self.display {
+			GeoMap::Geo(path) => path,
+			GeoMap::Flat { svg, .. } => svg,
+		};
+
+		std::iter::once(display).chain(&self.maps)
+	}
+}
+
 #[derive(Debug, Deserialize)]
 struct Node {
 	id: Id,
@@ -8,7 +8,7 @@ use std::rc::Rc;
 
 use bars_config::{
 	BlockDisplay, Color, EdgeDisplay, FillStyle, Geo, GeoPoint, NodeDisplay,
-	Path, Point, Style, Target,
+	Path, Point, Style, Target, LOD_TOLERANCES,
 };
 
 use kml::types::{Geometry, Placemark, Style as KmlStyle, StyleMap};
@@ -19,9 +19,8 @@ use kurbo::PathEl;
 use usvg::tiny_skia_path::PathSegment;
 use usvg::{Group, Node, Paint, Tree};
 
-pub fn convert<T: Clone + Debug + MinMax>(
+pub fn convert<T: Clone + Debug + Default + MinMax + Simplify>(
 	input: impl Input<Point = T>,
-	styles_offset: usize,
 ) -> Map<T> {
 	#[derive(Clone, Copy, PartialEq)]
 	enum Context {
@@ -37,13 +36,12 @@ pub fn convert<T: Clone + Debug + MinMax>(
 		BlocksTarget,
 	}
 
-	fn visit<T: Clone + Debug + MinMax>(
+	fn visit<T: Clone + Debug + Default + MinMax + Simplify>(
 		input: impl Input<Point = T>,
 		map: &mut Map<T>,
 		mut context: Context,
 		mut id: Cow<str>,
 		styles: &mut HashMap<TempStyle, usize>,
-		styles_offset: usize,
 	) {
 		static SPLIT_CHARS: &[char] = &['_', ' ']; // inserted by Figma
 
@@ -121,9 +119,11 @@ pub fn convert<T: Clone + Debug + MinMax>(
 					fill_color: input_path.style.fill.unwrap_or_default(),
 				});
 
-				styles_offset + map.styles.len() - 1
+				map.styles.len() - 1
 			});
 			let path = Path {
+				levels: T::levels(&input_path.points),
+				bounds: bounds(&input_path.points),
 				points: input_path.points,
 				style: *style,
 			};
@@ -148,7 +148,7 @@ pub fn convert<T: Clone + Debug + MinMax>(
 						off: Vec::new(),
 						on: Vec::new(),
 						selected: Vec::new(),
-						target: Target { points: Vec::new() },
+						target: Target::default(),
 					});
 
 					match context {
@@ -158,6 +158,7 @@ pub fn convert<T: Clone + Debug + MinMax>(
 						Context::NodesTarget => {
 							ent.target = Target {
 								points: path.points,
+								bounds: path.bounds,
 							}
 						},
 						_ => unreachable!(),
@@ -181,6 +182,7 @@ pub fn convert<T: Clone + Debug + MinMax>(
 						BlockDisplay {
 							target: Target {
 								points: path.points,
+								bounds: path.bounds,
 							},
 						},
 					);
@@ -190,14 +192,7 @@ pub fn convert<T: Clone + Debug + MinMax>(
 		}
 
 		for group in input.groups() {
-			visit(
-				group,
-				map,
-				context,
-				Cow::Borrowed(&id),
-				styles,
-				styles_offset,
-			);
+			visit(group, map, context, Cow::Borrowed(&id), styles);
 		}
 	}
 
@@ -217,7 +212,6 @@ pub fn convert<T: Clone + Debug + MinMax>(
 		Context::None,
 		Cow::Borrowed(""),
 		&mut styles,
-		styles_offset,
 	);
 
 	map
@@ -236,6 +230,24 @@ pub struct Map<T: Clone + Debug> {
 	pub styles: Vec<Style>,
 }
 
+impl<T: Clone + Debug> Map<T> {
+	// shifts the style of every path, for when the map's styles are appended
+	// after those of other maps
+	pub fn offset_styles(&mut self, offset: usize) {
+		let nodes = self.nodes.values_mut().flat_map(|node| {
+			(node.off.iter_mut())
+				.chain(&mut node.on)
+				.chain(&mut node.selected)
+		});
+		let edges = (self.edges.values_mut())
+			.flat_map(|edge| edge.off.iter_mut().chain(&mut edge.on));
+
+		for path in self.base.iter_mut().chain(nodes).chain(edges) {
+			path.style += offset;
+		}
+	}
+}
+
 #[derive(Clone, Copy, Debug, Hash, PartialEq, Eq)]
 pub struct TempStyle {
 	stroke_width: u8,
@@ -288,17 +300,113 @@ impl MinMax for Point {
 	}
 }
 
-// fake impl, views are not used for geo displays
 impl MinMax for GeoPoint {
-	fn min(&self, _other: &Self) -> Self {
-		*self
+	fn min(&self, other: &Self) -> Self {
+		Self {
+			geo: Geo {
+				lat: self.geo.lat.min(other.geo.lat),
+				lon: self.geo.lon.min(other.geo.lon),
+			},
+			offset: self.offset.min(&other.offset),
+		}
+	}
+
+	fn max(&self, other: &Self) -> Self {
+		Self {
+			geo: Geo {
+				lat: self.geo.lat.max(other.geo.lat),
+				lon: self.geo.lon.max(other.geo.lon),
+			},
+			offset: self.offset.max(&other.offset),
+		}
+	}
+}
+
+fn bounds<T: Clone + Default + MinMax>(points: &[T]) -> (T, T) {
+	let Some(first) = points.first() else {
+		return Default::default()
+	};
+
+	points
+		.iter()
+		.fold((first.clone(), first.clone()), |(min, max), point| {
+			(min.min(point), max.max(point))
+		})
+}
+
+pub trait Simplify: Sized {
+	fn levels(points: &[Self]) -> Vec<u8>;
+}
+
+// views are drawn fitted to the screen, so they are not simplified
+impl Simplify for Point {
+	fn levels(_points: &[Self]) -> Vec<u8> {
+		Vec::new()
 	}
+}
 
-	fn max(&self, _other: &Self) -> Self {
-		*self
+// douglas-peucker over the geo positions only, as inputs never set offsets
+impl Simplify for GeoPoint {
+	fn levels(points: &[Self]) -> Vec<u8> {
+		let Some(last) = points.len().checked_sub(1) else {
+			return Vec::new()
+		};
+		let top = (LOD_TOLERANCES.len() - 1) as u8;
+
+		// a degree of longitude is shorter than one of latitude by this much
+		// across the path, which is small enough for one factor to hold
+		let (min, max) = (points.iter())
+			.map(|p| p.geo.lat as f64)
+			.fold((f64::MAX, f64::MIN), |(a, b), lat| (a.min(lat), b.max(lat)));
+		let lon_scale = ((min + max) * 0.5).to_radians().cos();
+
+		let mut levels = vec![0; points.len()];
+		levels[0] = top;
+		levels[last] = top;
+
+		// a split point is kept at each level whose tolerance its distance
+		// exceeds, but never coarser than the span it splits, which gives the
+		// same result as simplifying separately for every level
+		let mut spans = vec![(0, last, top)];
+		while let Some((a, b, max)) = spans.pop() {
+			let Some((i, d)) = (a + 1..b)
+				.map(|i| (i, distance(&points[i], &points[a], &points[b], lon_scale)))
+				.max_by(|x, y| x.1.total_cmp(&y.1))
+			else {
+				continue
+			};
+
+			let level = (LOD_TOLERANCES.iter())
+				.rposition(|&t| d > t as f64)
+				.unwrap_or(0) as u8;
+
+			levels[i] = level.min(max);
+			spans.push((a, i, levels[i]));
+			spans.push((i, b, levels[i]));
+		}
+
+		levels
 	}
 }
 
+// distance of p from the segment a-b, in degrees of latitude, with
+// longitudes scaled to match
+fn distance(p: &GeoPoint, a: &GeoPoint, b: &GeoPoint, lon_scale: f64) -> f64 {
+	let (px, py) = (p.geo.lat as f64, p.geo.lon as f64 * lon_scale);
+	let (ax, ay) = (a.geo.lat as f64, a.geo.lon as f64 * lon_scale);
+	let (bx, by) = (b.geo.lat as f64, b.geo.lon as f64 * lon_scale);
+
+	let (dx, dy) = (bx - ax, by - ay);
+	let length = dx * dx + dy * dy;
+	let t = if length > 0.0 {
+		(((px - ax) * dx + (py - ay) * dy) / length).clamp(0.0, 1.0)
+	} else {
+		0.0
+	};
+
+	(px - ax - t * dx).hypot(py - ay - t * dy)
+}
+
 pub trait Input: Sized {
 	type Point;
 